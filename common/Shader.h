@@ -12,8 +12,10 @@ class Shader
 {
 public:
     GLuint Program;
-    // Constructor generates the shader on the fly
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
+    // Constructor generates the shader on the fly. The feedback varyings, if any, are
+    // captured interleaved by the transform feedback
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath,
+           const GLchar* const* feedbackVaryings = NULL, GLsizei numFeedbackVaryings = 0)
     {
         // 1. Retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -75,6 +77,8 @@ public:
         this->Program = glCreateProgram();
         glAttachShader(this->Program, vertex);
         glAttachShader(this->Program, fragment);
+        if (numFeedbackVaryings > 0)
+            glTransformFeedbackVaryings(this->Program, numFeedbackVaryings, feedbackVaryings, GL_INTERLEAVED_ATTRIBS);
         glLinkProgram(this->Program);
         // Print linking errors if any
         glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
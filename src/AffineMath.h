@@ -0,0 +1,219 @@
+#ifndef AFFINEMATH_H_INCLUDED
+#define AFFINEMATH_H_INCLUDED
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define AFFINE_AVX
+    #define AFFINE_SSE
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define AFFINE_SSE
+#endif
+
+/**
+* Kernels for affine transforms stored as the first three rows of a 4x4 matrix, in
+* row-major order (12 floats). The fourth row is always 0,0,0,1 so it's never stored
+* nor multiplied. This is the same layout of the baked palettes and of the bones in
+* the shaders
+*/
+
+//Floats of each bone in dual quaternion form: real and dual parts
+#define DUAL_QUAT_FLOATS 8
+
+//Names of the instruction sets used by affineMul
+#if defined(AFFINE_AVX)
+    #define AFFINE_KERNEL_NAME "AVX"
+#elif defined(AFFINE_SSE)
+    #define AFFINE_KERNEL_NAME "SSE"
+#else
+    #define AFFINE_KERNEL_NAME "scalar"
+#endif
+
+/**
+* out = a * b. out can be a or b
+*/
+inline void affineMulScalar(const float *a, const float *b, float *out){
+    float r[12];
+    for (int row = 0; row < 3; row++){
+        const float *ar = a + row * 4;
+        for (int col = 0; col < 4; col++){
+            r[row * 4 + col] = ar[0] * b[col] + ar[1] * b[4 + col] + ar[2] * b[8 + col];
+        }
+        r[row * 4 + 3] += ar[3];
+    }
+    memcpy(out, r, sizeof(r));
+}
+
+/**
+* out = a * b with the widest instruction set available. out can be a or b
+*/
+inline void affineMul(const float *a, const float *b, float *out){
+#if defined(AFFINE_AVX)
+    //Rows 0 and 1 are calculated together in the two halves of a 256 bits register
+    const __m128 b0 = _mm_loadu_ps(b);
+    const __m128 b1 = _mm_loadu_ps(b + 4);
+    const __m128 b2 = _mm_loadu_ps(b + 8);
+    const __m128 w = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+    const __m256 bb0 = _mm256_insertf128_ps(_mm256_castps128_ps256(b0), b0, 1);
+    const __m256 bb1 = _mm256_insertf128_ps(_mm256_castps128_ps256(b1), b1, 1);
+    const __m256 bb2 = _mm256_insertf128_ps(_mm256_castps128_ps256(b2), b2, 1);
+    const __m256 ww = _mm256_insertf128_ps(_mm256_castps128_ps256(w), w, 1);
+
+    //Each element of the rows of a repeated in its half
+    const __m256 a01 = _mm256_loadu_ps(a);
+    __m256 r01 = _mm256_mul_ps(_mm256_permute_ps(a01, 0x00), bb0);
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_permute_ps(a01, 0x55), bb1));
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_permute_ps(a01, 0xAA), bb2));
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_permute_ps(a01, 0xFF), ww));
+
+    const __m128 a2 = _mm_loadu_ps(a + 8);
+    __m128 r2 = _mm_mul_ps(_mm_shuffle_ps(a2, a2, 0x00), b0);
+    r2 = _mm_add_ps(r2, _mm_mul_ps(_mm_shuffle_ps(a2, a2, 0x55), b1));
+    r2 = _mm_add_ps(r2, _mm_mul_ps(_mm_shuffle_ps(a2, a2, 0xAA), b2));
+    r2 = _mm_add_ps(r2, _mm_mul_ps(_mm_shuffle_ps(a2, a2, 0xFF), w));
+
+    _mm256_storeu_ps(out, r01);
+    _mm_storeu_ps(out + 8, r2);
+#elif defined(AFFINE_SSE)
+    const __m128 b0 = _mm_loadu_ps(b);
+    const __m128 b1 = _mm_loadu_ps(b + 4);
+    const __m128 b2 = _mm_loadu_ps(b + 8);
+    //The translation of a only goes to the last column
+    const __m128 w = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+    __m128 r[3];
+
+    for (int row = 0; row < 3; row++){
+        const __m128 ar = _mm_loadu_ps(a + row * 4);
+        r[row] = _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0x00), b0);
+        r[row] = _mm_add_ps(r[row], _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0x55), b1));
+        r[row] = _mm_add_ps(r[row], _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0xAA), b2));
+        r[row] = _mm_add_ps(r[row], _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0xFF), w));
+    }
+    _mm_storeu_ps(out, r[0]);
+    _mm_storeu_ps(out + 4, r[1]);
+    _mm_storeu_ps(out + 8, r[2]);
+#else
+    affineMulScalar(a, b, out);
+#endif
+}
+
+/**
+* Builds translation * rotation * scale. q is the unit quaternion (w, x, y, z)
+*/
+inline void affineFromTRS(const float *t, const float *q, const float *s, float *out){
+    const float w = q[0], x = q[1], y = q[2], z = q[3];
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float wx = w * x, wy = w * y, wz = w * z;
+
+    out[0] = (1.0f - 2.0f * (yy + zz)) * s[0];
+    out[1] = 2.0f * (xy - wz) * s[1];
+    out[2] = 2.0f * (xz + wy) * s[2];
+    out[3] = t[0];
+    out[4] = 2.0f * (xy + wz) * s[0];
+    out[5] = (1.0f - 2.0f * (xx + zz)) * s[1];
+    out[6] = 2.0f * (yz - wx) * s[2];
+    out[7] = t[1];
+    out[8] = 2.0f * (xz - wy) * s[0];
+    out[9] = 2.0f * (yz + wx) * s[1];
+    out[10] = (1.0f - 2.0f * (xx + yy)) * s[2];
+    out[11] = t[2];
+}
+
+/**
+* Axis aligned box containing the box in (min x, y, z, max x, y, z) transformed by m
+*/
+inline void affineTransformBounds(const float *m, const float *in, float *out){
+    for (int row = 0; row < 3; row++){
+        const float *mr = m + row * 4;
+        float center = mr[3], extent = 0;
+        for (int col = 0; col < 3; col++){
+            center += mr[col] * (in[col] + in[3 + col]) * 0.5f;
+            extent += fabsf(mr[col]) * (in[3 + col] - in[col]) * 0.5f;
+        }
+        out[row] = center - extent;
+        out[3 + row] = center + extent;
+    }
+}
+
+//Largest difference from 1 of the scale of a column accepted as a rigid transform
+#define DUAL_QUAT_SCALE_TOLERANCE 1e-3f
+
+/**
+* Unit dual quaternion of an affine transform, as the real part (x, y, z, w) followed by
+* the dual part (x, y, z, w). Dual quaternions can't represent scaling, so the columns of
+* the 3x3 part are normalized before taking the rotation and the scale is dropped. Returns
+* false if the transform had a scale different from 1
+*/
+inline bool affineToDualQuat(const float *m, float *dq){
+    //Rotation part without the scale of each column
+    float r[9];
+    bool rigid = true;
+    for (int col = 0; col < 3; col++){
+        const float scale = sqrtf(m[col] * m[col] + m[4 + col] * m[4 + col] + m[8 + col] * m[8 + col]);
+        const float inv = scale > 0 ? 1.0f / scale : 0.0f;
+        for (int row = 0; row < 3; row++){
+            r[row * 3 + col] = m[row * 4 + col] * inv;
+        }
+        if (fabsf(scale - 1.0f) > DUAL_QUAT_SCALE_TOLERANCE) rigid = false;
+    }
+
+    //Quaternion of the rotation, from the largest diagonal to keep the precision
+    float q[4];
+    const float trace = r[0] + r[4] + r[8];
+    if (trace > 0.0f){
+        const float s = 0.5f / sqrtf(trace + 1.0f);
+        q[3] = 0.25f / s;
+        q[0] = (r[7] - r[5]) * s;
+        q[1] = (r[2] - r[6]) * s;
+        q[2] = (r[3] - r[1]) * s;
+    } else if (r[0] > r[4] && r[0] > r[8]){
+        const float s = 2.0f * sqrtf(1.0f + r[0] - r[4] - r[8]);
+        q[3] = (r[7] - r[5]) / s;
+        q[0] = 0.25f * s;
+        q[1] = (r[1] + r[3]) / s;
+        q[2] = (r[2] + r[6]) / s;
+    } else if (r[4] > r[8]){
+        const float s = 2.0f * sqrtf(1.0f + r[4] - r[0] - r[8]);
+        q[3] = (r[2] - r[6]) / s;
+        q[0] = (r[1] + r[3]) / s;
+        q[1] = 0.25f * s;
+        q[2] = (r[5] + r[7]) / s;
+    } else {
+        const float s = 2.0f * sqrtf(1.0f + r[8] - r[0] - r[4]);
+        q[3] = (r[3] - r[1]) / s;
+        q[0] = (r[2] + r[6]) / s;
+        q[1] = (r[5] + r[7]) / s;
+        q[2] = 0.25f * s;
+    }
+    const float len = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (int i = 0; i < 4; i++){
+        dq[i] = len > 0 ? q[i] / len : (i == 3 ? 1.0f : 0.0f);
+    }
+
+    //Dual part: 0.5 * (t, 0) * q
+    const float tx = m[3], ty = m[7], tz = m[11];
+    const float x = dq[0], y = dq[1], z = dq[2], w = dq[3];
+    dq[4] = 0.5f * (w * tx + ty * z - tz * y);
+    dq[5] = 0.5f * (w * ty + tz * x - tx * z);
+    dq[6] = 0.5f * (w * tz + tx * y - ty * x);
+    dq[7] = -0.5f * (tx * x + ty * y + tz * z);
+    return rigid;
+}
+
+/**
+* Converts a palette of numBones packed transforms to DUAL_QUAT_FLOATS floats per bone.
+* Returns false if any of them had a scale, which is lost
+*/
+inline bool affinePaletteToDualQuats(const float *palette, int numBones, float *out){
+    bool rigid = true;
+    for (int bone = 0; bone < numBones; bone++){
+        if (!affineToDualQuat(palette + bone * 12, out + bone * DUAL_QUAT_FLOATS)) rigid = false;
+    }
+    return rigid;
+}
+
+#endif // AFFINEMATH_H_INCLUDED
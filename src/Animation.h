@@ -1,6 +1,938 @@
+#ifndef ANIMATION_H_INCLUDED
+#define ANIMATION_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+
+#include "ogldev_math_3d.h"
+#include "MappedFile.h"
+#include "AffineMath.h"
+
+using namespace std;
+
+//Floats used for each baked bone matrix. We only keep the first three rows of the
+//4x4 transform, in row-major order, because the last one is always 0,0,0,1
+#define BAKED_MATRIX_FLOATS 12
+//Alignment in bytes of the baked poses buffer
+#define BAKED_POSES_ALIGN 16
+//Floats of a bounding box: min x, y, z and max x, y, z
+#define BAKED_BOUNDS_FLOATS 6
+//Version of the file format of the baked poses cache. Change it when the format or the
+//way of baking changes, so the old caches are discarded
+#define BAKED_CACHE_VERSION 2
+//Palettes kept by the pose cache of a model. When all of them are used in the current
+//frame, the other poses are evaluated without sharing them
+#define POSE_CACHE_MAX_ENTRIES 64
+
+//When the bone transforms of the animations are precalculated
+enum eBakeMode {
+    //Never, they are calculated in every Draw
+    BAKE_NONE = 0,
+    //All the frames of all the animations when the model is loaded
+    BAKE_ALL,
+    //The whole animation on the first Draw that uses it
+    BAKE_LAZY,
+    //Like BAKE_LAZY but in a background thread. Meanwhile they are calculated in every Draw
+    BAKE_LAZY_ASYNC
+};
+
+//How the shader blends the bones of each vertex
+enum eSkinningMode {
+    //Weighted sum of 3x4 matrices
+    SKINNING_LINEAR = 0,
+    //Weighted sum of dual quaternions. Half the size, but without scaling
+    SKINNING_DUAL_QUATERNION
+};
 
 class Animation {
     public:
         Animation(){};
         ~Animation(){};
 };
+
+//Components of a channel of an animation, each one with its own keys
+enum eKeyType {
+    KEY_POSITION = 0,
+    KEY_ROTATION,
+    KEY_SCALING,
+    KEY_TYPES
+};
+
+/**
+* Precalculated info to search the keys of one component of a channel
+*/
+struct KeyTrackInfo {
+    //The keys are evenly spaced, so we can get the index directly from the time
+    bool uniform;
+    float firstTime;
+    float invStep;
+
+    KeyTrackInfo(){
+        uniform = false;
+        firstTime = 0;
+        invStep = 0;
+    }
+
+    /**
+    * Checks if the keys are evenly spaced. T must have the member mTime
+    */
+    template <class T> void init(const T *keys, uint32_t numKeys){
+        uniform = false;
+        firstTime = 0;
+        invStep = 0;
+        if (numKeys < 2) return;
+
+        firstTime = keys[0].mTime;
+        const double step = (keys[numKeys - 1].mTime - keys[0].mTime) / (numKeys - 1);
+        if (step <= 0) return;
+
+        for (uint32_t i = 1; i < numKeys; i++){
+            if (fabs(keys[i].mTime - (keys[0].mTime + i * step)) > step * 0.001)
+                return;
+        }
+        uniform = true;
+        invStep = 1.0 / step;
+    }
+};
+
+/**
+* Node of the flattened hierarchy of a model, with everything resolved at load time
+*/
+struct SkeletonNode {
+    //Index of the parent node, always lower than the index of this node. -1 for the root
+    int parent;
+    //Bone moved by this node, -1 if none
+    int bone;
+    //The node is skipped in the reduced skeleton of the far LODs
+    bool lodSkip;
+    //Packed transformation of the node when it isn't animated
+    float localTransform[BAKED_MATRIX_FLOATS];
+};
+
+/**
+* Node of the scene as it is read from assimp or from the mesh cache, before resolving
+* its bone and channels
+*/
+struct SceneNode {
+    string name;
+    //Index of the parent node, always lower than the index of this node. -1 for the root
+    int parent;
+    Matrix4f transform;
+};
+
+/**
+* Last key used of every channel of an animation. Each animated instance can have its
+* own cursor, so playing forward finds the keys in constant time
+*/
+class AnimationCursor {
+    public:
+        AnimationCursor(){
+            nAnim = -1;
+        }
+
+        /**
+        * Returns the slots of a channel, resetting them if the animation changed
+        */
+        uint32_t *getChannel(int nAnim, int nChannel, int numChannels){
+            if (this->nAnim != nAnim || (int)lastKey.size() != numChannels * KEY_TYPES){
+                this->nAnim = nAnim;
+                lastKey.assign(numChannels * KEY_TYPES, 0);
+            }
+            return &lastKey[nChannel * KEY_TYPES];
+        }
+
+    private:
+        int nAnim;
+        vector<uint32_t> lastKey;
+};
+
+/**
+* Counters of the evaluations of poses of all the models. They can be updated from any thread
+*/
+struct PoseCacheStats {
+    atomic<long> lookups;
+    atomic<long> hits;
+    atomic<long> bonesEvaluated;
+};
+
+/**
+* Palettes of the poses evaluated in the current frame of a model, keyed by animation and
+* quantized time. Instances in the same state share the palette instead of evaluating it.
+* It can be used from several threads
+*/
+class PoseCache {
+    public:
+        PoseCache(){
+            numFloats = 0;
+        }
+
+        /**
+        *
+        */
+        void init(int numBones){
+            lock_guard<mutex> lock(entriesMutex);
+            entries.clear();
+            numFloats = numBones * BAKED_MATRIX_FLOATS;
+        }
+
+        /**
+        * Returns the palette evaluated in this frame for the state. If nobody has evaluated it
+        * yet, returns an empty palette for it and sets mustEvaluate. The caller must evaluate
+        * it and call setReady. Returns NULL if other thread is evaluating it right now, or if
+        * the POSE_CACHE_MAX_ENTRIES palettes are already used in this frame
+        */
+        float *find(int nAnim, int64_t timeKey, bool &mustEvaluate){
+            getStats().lookups++;
+            mustEvaluate = false;
+            lock_guard<mutex> lock(entriesMutex);
+            const unsigned int frame = currentFrame();
+            size_t free = entries.size();
+
+            for (size_t i = 0; i < entries.size(); i++){
+                Entry &entry = entries[i];
+                if (entry.frame != frame){
+                    //The oldest one is reused first
+                    if (free == entries.size() || entry.frame < entries[free].frame) free = i;
+                } else if (entry.nAnim == nAnim && entry.timeKey == timeKey){
+                    if (!entry.ready) return NULL;
+                    getStats().hits++;
+                    return &entry.palette[0];
+                }
+            }
+
+            //Reusing the entries of other frames. The ones of this frame can still be in use
+            if (free == entries.size()){
+                if (entries.size() >= POSE_CACHE_MAX_ENTRIES) return NULL;
+                entries.push_back(Entry());
+                entries[free].palette.resize(numFloats);
+            }
+            entries[free].nAnim = nAnim;
+            entries[free].timeKey = timeKey;
+            entries[free].frame = frame;
+            entries[free].ready = false;
+            mustEvaluate = true;
+            return &entries[free].palette[0];
+        }
+
+        /**
+        * The palette returned by find for the state is evaluated
+        */
+        void setReady(int nAnim, int64_t timeKey){
+            lock_guard<mutex> lock(entriesMutex);
+            for (size_t i = 0; i < entries.size(); i++){
+                Entry &entry = entries[i];
+                if (entry.frame == currentFrame() && entry.nAnim == nAnim && entry.timeKey == timeKey){
+                    entry.ready = true;
+                }
+            }
+        }
+
+        /**
+        * Must be called once at the start of every frame, when no pose is being evaluated.
+        * The poses of the last frame aren't shared anymore. Without it the entries are never
+        * freed, and once the cache is full every pose is evaluated again
+        */
+        static void nextFrame(){
+            currentFrame()++;
+        }
+
+        static PoseCacheStats &getStats(){
+            static PoseCacheStats stats;
+            return stats;
+        }
+
+        static void resetStats(){
+            getStats().lookups = 0;
+            getStats().hits = 0;
+            getStats().bonesEvaluated = 0;
+        }
+
+    private:
+        //Not copyable
+        PoseCache(const PoseCache &);
+        PoseCache &operator=(const PoseCache &);
+
+        //The palette keeps its buffer when the vector of entries grows
+        struct Entry {
+            int nAnim;
+            int64_t timeKey;
+            unsigned int frame;
+            bool ready;
+            vector<float> palette;
+        };
+
+        static unsigned int &currentFrame(){
+            static unsigned int frame = 1;
+            return frame;
+        }
+
+        vector<Entry> entries;
+        mutex entriesMutex;
+        int numFloats;
+};
+
+/**
+* Level of detail of the animation of an object, chosen by its distance to the camera
+*/
+struct AnimationLod {
+    //Minimum distance to use this level
+    float distance;
+    //The pose is evaluated every updateEvery frames and interpolated between them
+    int updateEvery;
+    //Skips the detail bones, like fingers and face, moving them with their parents
+    bool reducedBones;
+};
+
+/**
+* Pose state of one animated object. Each object has its own, so the poses of several
+* objects of the same model can be calculated at the same time
+*/
+class AnimationInstance {
+    public:
+        AnimationInstance(){
+            palette = NULL;
+            nAnim = 0;
+            lodValid = false;
+            lodLevel = 0;
+            prevTime = 0;
+            nextTime = 0;
+            lastFrame = 0;
+        }
+
+        //Palette to upload in the next Draw, in the format of the skinning mode of the model.
+        //It can point to buffer, to the baked poses, to a pose shared with other instances
+        //or to dualQuats. NULL if not animated
+        const float *palette;
+        int nAnim;
+        //Last keys used to animate this object
+        AnimationCursor cursor;
+        //Palette of this instance when it can't be shared
+        vector<float> buffer;
+        //Scratch global transform of each node
+        vector<float> globals;
+        //The palette converted to dual quaternions
+        vector<float> dualQuats;
+
+        //The poses evaluated by the LOD, and their times, interpolated in the frames between
+        bool lodValid;
+        int lodLevel;
+        float prevTime;
+        float nextTime;
+        vector<float> prevPalette;
+        vector<float> nextPalette;
+        //Time of the last update, to know the time between frames
+        float lastFrame;
+};
+
+/**
+* Index of the key where the interpolation for the time starts, scanning from the
+* first key. This was the original search, only kept to compare times
+*/
+template <class T> uint32_t findKeyLinear(const T *keys, uint32_t numKeys, float time){
+    for (uint32_t i = 0 ; i + 1 < numKeys ; i++) {
+        if (time < (float)keys[i + 1].mTime) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/**
+* Index of the key where the interpolation for the time starts. Times after the
+* last key return the last segment. cursor (optional) keeps the last index found
+*/
+template <class T> uint32_t findKey(const T *keys, uint32_t numKeys, float time,
+                                    const KeyTrackInfo &info, uint32_t *cursor){
+    if (numKeys < 2) return 0;
+    const uint32_t last = numKeys - 2;
+    uint32_t index;
+
+    if (cursor != NULL && *cursor <= last && time >= (float)keys[*cursor].mTime){
+        //Playing forward we are in the same segment or in the next one most of the time
+        index = *cursor;
+        if (index == last || time < (float)keys[index + 1].mTime){
+            return index;
+        }
+        if (index + 1 == last || time < (float)keys[index + 2].mTime){
+            *cursor = index + 1;
+            return index + 1;
+        }
+    }
+
+    if (info.uniform){
+        const float pos = (time - info.firstTime) * info.invStep;
+        index = pos <= 0 ? 0 : (pos >= last ? last : (uint32_t)pos);
+        //Correcting the float precision errors
+        while (index > 0 && time < (float)keys[index].mTime) index--;
+        while (index < last && time >= (float)keys[index + 1].mTime) index++;
+    } else {
+        //First key with a time greater than the searched
+        uint32_t lo = 1, hi = numKeys - 1;
+        while (lo < hi){
+            const uint32_t mid = (lo + hi) / 2;
+            if ((float)keys[mid].mTime > time){
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        index = (float)keys[lo].mTime > time ? lo - 1 : last;
+    }
+
+    if (cursor != NULL)
+        *cursor = index;
+    return index;
+}
+
+/**
+* Compares the original linear search of keys with the new ones on a long clip
+*/
+inline void benchmarkKeyLookup(uint32_t numKeys, uint32_t numSamples){
+    struct BenchKey {
+        double mTime;
+    };
+    vector<BenchKey> keys(numKeys);
+    for (uint32_t i = 0; i < numKeys; i++){
+        keys[i].mTime = i;
+    }
+    KeyTrackInfo uniformInfo;
+    uniformInfo.init(&keys[0], numKeys);
+    KeyTrackInfo noInfo;
+
+    //Sampling the clip forward, like an animation playing
+    const float dt = (float)(numKeys - 1) / numSamples;
+    volatile uint32_t sink = 0;
+    double times[4];
+
+    for (int method = 0; method < 4; method++){
+        uint32_t cursor = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (uint32_t i = 0; i < numSamples; i++){
+            const float t = i * dt;
+            switch (method){
+                case 0: sink += findKeyLinear(&keys[0], numKeys, t); break;
+                case 1: sink += findKey(&keys[0], numKeys, t, noInfo, (uint32_t *)NULL); break;
+                case 2: sink += findKey(&keys[0], numKeys, t, noInfo, &cursor); break;
+                case 3: sink += findKey(&keys[0], numKeys, t, uniformInfo, (uint32_t *)NULL); break;
+            }
+        }
+        times[method] = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    cout << "Key lookup of " << numSamples << " samples in a clip of " << numKeys << " keys:" << endl;
+    cout << "  linear: " << times[0] << " ms" << endl;
+    cout << "  binary: " << times[1] << " ms" << endl;
+    cout << "  cursor: " << times[2] << " ms" << endl;
+    cout << "  evenly spaced: " << times[3] << " ms" << endl;
+}
+
+/**
+* Header of a file of baked poses. It's followed by the number of frames of each animation,
+* and then by the palettes of all the frames starting at dataOffset
+*/
+struct BakedCacheHeader {
+    char magic[4];
+    uint32_t version;
+    //Hash of the model file the poses were baked from
+    uint64_t sourceHash;
+    //Hash of the palettes
+    uint64_t dataHash;
+    float fpsModelFactor;
+    uint32_t numBones;
+    uint32_t numAnimations;
+    //Aligned to BAKED_POSES_ALIGN from the start of the file
+    uint32_t dataOffset;
+};
+
+/**
+* Precalculated bone transforms of all the animations of a model.
+* The frames are ordered by [anim][frame][bone], so the palette of a frame is a contiguous
+* span of numBones * BAKED_MATRIX_FLOATS floats. All the animations can live in one
+* aligned allocation, or each animation in its own when it is baked on demand, or be
+* mapped from a cache file
+*/
+class BakedPoses {
+    public:
+        //State of the bake of each animation
+        enum eAnimState {
+            ANIM_EMPTY = 0,
+            ANIM_BAKING,
+            ANIM_READY
+        };
+
+        BakedPoses(){
+            rawData = NULL;
+            numBones = 0;
+            animState = NULL;
+        }
+
+        ~BakedPoses(){
+            clear();
+        }
+
+        /**
+        * Sets the frames of each animation. If allocateAll, reserves the space for all
+        * of them in only one buffer. If not, each animation is reserved with allocateAnimation
+        */
+        void init(int numBones, const vector<int> &framesPerAnim, bool allocateAll = true){
+            clear();
+            this->numBones = numBones;
+            this->animFrames = framesPerAnim;
+            animData.assign(framesPerAnim.size(), (float *)NULL);
+            animRawData.assign(framesPerAnim.size(), (void *)NULL);
+            animBounds.assign(framesPerAnim.size(), vector<float>());
+            clipBounds.assign(framesPerAnim.size() * BAKED_BOUNDS_FLOATS, 0.0f);
+            animState = new atomic<int>[framesPerAnim.size()];
+            for (size_t nAnim = 0; nAnim < framesPerAnim.size(); nAnim++){
+                animState[nAnim] = ANIM_EMPTY;
+            }
+
+            if (allocateAll){
+                size_t totalFrames = 0;
+                for (size_t nAnim = 0; nAnim < framesPerAnim.size(); nAnim++){
+                    totalFrames += framesPerAnim[nAnim];
+                }
+
+                float *data = allocate(totalFrames * numBones * BAKED_MATRIX_FLOATS, rawData);
+                if (data != NULL){
+                    for (size_t nAnim = 0; nAnim < framesPerAnim.size(); nAnim++){
+                        animData[nAnim] = data;
+                        data += (size_t)framesPerAnim[nAnim] * numBones * BAKED_MATRIX_FLOATS;
+                    }
+                }
+            }
+        }
+
+        /**
+        * Reserves the space of one animation if it doesn't have it yet
+        */
+        void allocateAnimation(int nAnim){
+            if (nAnim < 0 || nAnim >= (int)animFrames.size() || animData[nAnim] != NULL) return;
+            animData[nAnim] = allocate((size_t)animFrames[nAnim] * numBones * BAKED_MATRIX_FLOATS, animRawData[nAnim]);
+        }
+
+        /**
+        *
+        */
+        void clear(){
+            if (rawData != NULL){
+                free(rawData);
+            }
+            for (size_t nAnim = 0; nAnim < animRawData.size(); nAnim++){
+                if (animRawData[nAnim] != NULL){
+                    free(animRawData[nAnim]);
+                }
+            }
+            if (animState != NULL){
+                delete [] animState;
+            }
+            cacheFile.close();
+            rawData = NULL;
+            animState = NULL;
+            numBones = 0;
+            animData.clear();
+            animRawData.clear();
+            animFrames.clear();
+            animBounds.clear();
+            clipBounds.clear();
+        }
+
+        /**
+        * Returns the first float of the palette of a frame, or NULL if it doesn't exist
+        */
+        float *getPalette(int nAnim, int nFrame){
+            if (nAnim < 0 || nAnim >= (int)animFrames.size() || animData[nAnim] == NULL
+                || nFrame < 0 || nFrame >= animFrames[nAnim]){
+                return NULL;
+            }
+            return animData[nAnim] + (size_t)nFrame * numBones * BAKED_MATRIX_FLOATS;
+        }
+
+        /**
+        * Marks the animation as being baked. Returns false if somebody else did it before
+        */
+        bool startBake(int nAnim){
+            if (nAnim < 0 || nAnim >= (int)animFrames.size()) return false;
+            int expected = ANIM_EMPTY;
+            return animState[nAnim].compare_exchange_strong(expected, ANIM_BAKING);
+        }
+
+        /**
+        * All the frames of the animation are baked. It can be called from any thread
+        */
+        void setReady(int nAnim){
+            animState[nAnim] = ANIM_READY;
+        }
+
+        bool isReady(int nAnim){
+            return nAnim >= 0 && nAnim < (int)animFrames.size() && animState[nAnim] == ANIM_READY;
+        }
+
+        bool isEmpty(){
+            for (size_t nAnim = 0; nAnim < animData.size(); nAnim++){
+                if (animData[nAnim] != NULL) return false;
+            }
+            return true;
+        }
+
+        int getNumBones(){return numBones;}
+        int getNumAnimations(){return animFrames.size();}
+
+        int getNumFrames(int nAnim){
+            return nAnim >= 0 && nAnim < (int)animFrames.size() ? animFrames[nAnim] : 0;
+        }
+
+        /**
+        * Bytes of the animations reserved
+        */
+        size_t getSizeInBytes(){
+            size_t totalFrames = 0;
+            for (size_t nAnim = 0; nAnim < animFrames.size(); nAnim++){
+                if (animData[nAnim] != NULL)
+                    totalFrames += animFrames[nAnim];
+            }
+            return totalFrames * numBones * BAKED_MATRIX_FLOATS * sizeof(float);
+        }
+
+        /**
+        * Writes all the animations in a cache file. All of them must be reserved
+        */
+        bool saveCache(const string &path, uint64_t sourceHash, float fpsModelFactor){
+            if (animFrames.empty()) return false;
+            for (size_t nAnim = 0; nAnim < animFrames.size(); nAnim++){
+                if (animData[nAnim] == NULL) return false;
+            }
+
+            BakedCacheHeader header;
+            fillCacheHeader(header, sourceHash, fpsModelFactor, numBones, animFrames);
+            header.dataHash = hashData();
+
+            ofstream file(path.c_str(), ios::out | ios::binary | ios::trunc);
+            if (!file.is_open()) return false;
+            file.write((const char *)&header, sizeof(header));
+            for (size_t nAnim = 0; nAnim < animFrames.size(); nAnim++){
+                const uint32_t frames = animFrames[nAnim];
+                file.write((const char *)&frames, sizeof(frames));
+            }
+            const char padding[BAKED_POSES_ALIGN] = {0};
+            file.write(padding, header.dataOffset - sizeof(header) - animFrames.size() * sizeof(uint32_t));
+            for (size_t nAnim = 0; nAnim < animFrames.size(); nAnim++){
+                file.write((const char *)animData[nAnim], getSizeInBytes(nAnim));
+            }
+            return file.good();
+        }
+
+        /**
+        * Maps a cache file and uses its palettes directly. Returns false, leaving this empty,
+        * if the file doesn't exist, is corrupted or was made from other model or settings
+        */
+        bool loadCache(const string &path, uint64_t sourceHash, float fpsModelFactor,
+                       int numBones, const vector<int> &framesPerAnim){
+            clear();
+            if (!cacheFile.open(path)) return false;
+
+            BakedCacheHeader expected;
+            fillCacheHeader(expected, sourceHash, fpsModelFactor, numBones, framesPerAnim);
+            const char *bytes = (const char *)cacheFile.getData();
+            const BakedCacheHeader *header = (const BakedCacheHeader *)bytes;
+            size_t dataSize = 0;
+            for (size_t nAnim = 0; nAnim < framesPerAnim.size(); nAnim++){
+                dataSize += (size_t)framesPerAnim[nAnim] * numBones * BAKED_MATRIX_FLOATS * sizeof(float);
+            }
+
+            bool valid = cacheFile.getSize() == expected.dataOffset + dataSize
+                && memcmp(header->magic, expected.magic, sizeof(expected.magic)) == 0
+                && header->version == expected.version
+                && header->sourceHash == expected.sourceHash
+                && header->fpsModelFactor == expected.fpsModelFactor
+                && header->numBones == expected.numBones
+                && header->numAnimations == expected.numAnimations
+                && header->dataOffset == expected.dataOffset;
+            const uint32_t *frames = (const uint32_t *)(bytes + sizeof(BakedCacheHeader));
+            for (size_t nAnim = 0; valid && nAnim < framesPerAnim.size(); nAnim++){
+                valid = frames[nAnim] == (uint32_t)framesPerAnim[nAnim];
+            }
+            if (valid){
+                valid = MappedFile::hash(bytes + header->dataOffset, dataSize) == header->dataHash;
+            }
+            if (!valid){
+                cacheFile.close();
+                return false;
+            }
+
+            this->numBones = numBones;
+            this->animFrames = framesPerAnim;
+            animData.assign(framesPerAnim.size(), (float *)NULL);
+            animRawData.assign(framesPerAnim.size(), (void *)NULL);
+            animBounds.assign(framesPerAnim.size(), vector<float>());
+            clipBounds.assign(framesPerAnim.size() * BAKED_BOUNDS_FLOATS, 0.0f);
+            animState = new atomic<int>[framesPerAnim.size()];
+            float *data = (float *)(bytes + header->dataOffset);
+            for (size_t nAnim = 0; nAnim < framesPerAnim.size(); nAnim++){
+                animData[nAnim] = data;
+                animState[nAnim] = ANIM_READY;
+                data += (size_t)framesPerAnim[nAnim] * numBones * BAKED_MATRIX_FLOATS;
+            }
+            return true;
+        }
+
+        bool isMapped(){return cacheFile.isOpen();}
+
+        /**
+        * Calculates the bounding box of every baked frame of the animation, and their union.
+        * boneBounds has the box of the vertices of each bone in the bind pose, with min > max
+        * for the bones without vertices. They aren't saved in the cache, they are cheap to
+        * calculate again
+        */
+        void computeBounds(int nAnim, const float *boneBounds){
+            if (getPalette(nAnim, 0) == NULL) return;
+            vector<float> &bounds = animBounds[nAnim];
+            bounds.resize((size_t)animFrames[nAnim] * BAKED_BOUNDS_FLOATS);
+            float *clip = &clipBounds[nAnim * BAKED_BOUNDS_FLOATS];
+            resetBounds(clip);
+            for (int nFrame = 0; nFrame < animFrames[nAnim]; nFrame++){
+                float *frame = &bounds[nFrame * BAKED_BOUNDS_FLOATS];
+                poseBounds(getPalette(nAnim, nFrame), numBones, boneBounds, frame);
+                mergeBounds(clip, frame);
+            }
+        }
+
+        /**
+        * Bounding box of a baked frame, or NULL if it isn't calculated
+        */
+        const float *getFrameBounds(int nAnim, int nFrame){
+            if (nAnim < 0 || nAnim >= (int)animBounds.size() || nFrame < 0
+                || (size_t)nFrame * BAKED_BOUNDS_FLOATS >= animBounds[nAnim].size()){
+                return NULL;
+            }
+            return &animBounds[nAnim][nFrame * BAKED_BOUNDS_FLOATS];
+        }
+
+        /**
+        * Union of the bounding boxes of all the frames of an animation, or NULL if they aren't calculated
+        */
+        const float *getClipBounds(int nAnim){
+            if (nAnim < 0 || nAnim >= (int)animBounds.size() || animBounds[nAnim].empty()) return NULL;
+            return &clipBounds[nAnim * BAKED_BOUNDS_FLOATS];
+        }
+
+        /**
+        * Box that contains nothing, so any merge replaces it
+        */
+        static void resetBounds(float *aabb){
+            for (int i = 0; i < 3; i++){
+                aabb[i] = FLT_MAX;
+                aabb[3 + i] = -FLT_MAX;
+            }
+        }
+
+        static void mergeBounds(float *aabb, const float *other){
+            for (int i = 0; i < 3; i++){
+                aabb[i] = min(aabb[i], other[i]);
+                aabb[3 + i] = max(aabb[3 + i], other[3 + i]);
+            }
+        }
+
+        /**
+        * Conservative bounding box of the skinned vertices of a pose. A skinned vertex is a
+        * weighted average of the vertex moved by each of its bones, so it's inside the union
+        * of the boxes of the bones moved by their transforms
+        */
+        static void poseBounds(const float *palette, int numBones, const float *boneBounds, float *out){
+            resetBounds(out);
+            for (int bone = 0; bone < numBones; bone++){
+                const float *box = boneBounds + bone * BAKED_BOUNDS_FLOATS;
+                if (box[0] > box[3]) continue;
+                float moved[BAKED_BOUNDS_FLOATS];
+                affineTransformBounds(palette + bone * BAKED_MATRIX_FLOATS, box, moved);
+                mergeBounds(out, moved);
+            }
+        }
+
+        /**
+        * Bytes of one animation
+        */
+        size_t getSizeInBytes(int nAnim){
+            return (size_t)getNumFrames(nAnim) * numBones * BAKED_MATRIX_FLOATS * sizeof(float);
+        }
+
+        /**
+        * Packs the first three rows of the matrix in the destination
+        */
+        static void store(const Matrix4f &mat, float *dst){
+            memcpy(dst, &mat.m[0][0], BAKED_MATRIX_FLOATS * sizeof(float));
+        }
+
+        /**
+        * Expands a packed matrix to a full 4x4 matrix
+        */
+        static void load(const float *src, Matrix4f &mat){
+            memcpy(&mat.m[0][0], src, BAKED_MATRIX_FLOATS * sizeof(float));
+            mat.m[3][0] = 0;
+            mat.m[3][1] = 0;
+            mat.m[3][2] = 0;
+            mat.m[3][3] = 1;
+        }
+
+        /**
+        * Interpolates two packed matrices. The matrices are decomposed in translation,
+        * rotation and scale, so the rotation keeps its shape: translation and scale are
+        * blended linearly and the rotation with a normalized lerp of quaternions
+        */
+        static void blend(const float *a, const float *b, float t, float *dst){
+            float qa[4], qb[4], sa[3], sb[3];
+            decompose(a, qa, sa);
+            decompose(b, qb, sb);
+
+            //Taking the shortest path between the rotations
+            const float sign = qa[0]*qb[0] + qa[1]*qb[1] + qa[2]*qb[2] + qa[3]*qb[3] < 0 ? -1.0f : 1.0f;
+            float q[4], scale[3];
+            float len = 0;
+            for (int i=0; i < 4; i++){
+                q[i] = qa[i] + (sign * qb[i] - qa[i]) * t;
+                len += q[i] * q[i];
+            }
+            len = len > 0 ? 1.0f / sqrtf(len) : 0;
+            for (int i=0; i < 4; i++){
+                q[i] *= len;
+            }
+            for (int i=0; i < 3; i++){
+                scale[i] = sa[i] + (sb[i] - sa[i]) * t;
+            }
+
+            const float translation[3] = {a[3] + (b[3] - a[3]) * t,
+                                          a[7] + (b[7] - a[7]) * t,
+                                          a[11] + (b[11] - a[11]) * t};
+            affineFromTRS(translation, q, scale, dst);
+        }
+
+        /**
+        * Interpolates the palettes of two frames
+        */
+        static void blendPalette(const float *a, const float *b, float t, int numBones, float *dst){
+            for (int i=0; i < numBones; i++){
+                blend(a + i * BAKED_MATRIX_FLOATS, b + i * BAKED_MATRIX_FLOATS, t, dst + i * BAKED_MATRIX_FLOATS);
+            }
+        }
+
+        /**
+        * Splits the 3x3 part of a packed matrix in a rotation quaternion (w, x, y, z)
+        * and the scale of each column
+        */
+        static void decompose(const float *m, float *q, float *scale){
+            float r[3][3];
+            for (int col=0; col < 3; col++){
+                scale[col] = sqrtf(m[col]*m[col] + m[4 + col]*m[4 + col] + m[8 + col]*m[8 + col]);
+            }
+            //A mirrored matrix is a rotation with a negative scale
+            const float det = m[0] * (m[5]*m[10] - m[6]*m[9])
+                            - m[1] * (m[4]*m[10] - m[6]*m[8])
+                            + m[2] * (m[4]*m[9] - m[5]*m[8]);
+            if (det < 0) scale[0] = -scale[0];
+            for (int row=0; row < 3; row++){
+                for (int col=0; col < 3; col++){
+                    r[row][col] = scale[col] != 0 ? m[row * 4 + col] / scale[col] : 0;
+                }
+            }
+
+            const float trace = r[0][0] + r[1][1] + r[2][2];
+            if (trace > 0){
+                const float s = 0.5f / sqrtf(trace + 1.0f);
+                q[0] = 0.25f / s;
+                q[1] = (r[2][1] - r[1][2]) * s;
+                q[2] = (r[0][2] - r[2][0]) * s;
+                q[3] = (r[1][0] - r[0][1]) * s;
+            } else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]){
+                const float s = 2.0f * sqrtf(1.0f + r[0][0] - r[1][1] - r[2][2]);
+                q[0] = (r[2][1] - r[1][2]) / s;
+                q[1] = 0.25f * s;
+                q[2] = (r[0][1] + r[1][0]) / s;
+                q[3] = (r[0][2] + r[2][0]) / s;
+            } else if (r[1][1] > r[2][2]){
+                const float s = 2.0f * sqrtf(1.0f + r[1][1] - r[0][0] - r[2][2]);
+                q[0] = (r[0][2] - r[2][0]) / s;
+                q[1] = (r[0][1] + r[1][0]) / s;
+                q[2] = 0.25f * s;
+                q[3] = (r[1][2] + r[2][1]) / s;
+            } else {
+                const float s = 2.0f * sqrtf(1.0f + r[2][2] - r[0][0] - r[1][1]);
+                q[0] = (r[1][0] - r[0][1]) / s;
+                q[1] = (r[0][2] + r[2][0]) / s;
+                q[2] = (r[1][2] + r[2][1]) / s;
+                q[3] = 0.25f * s;
+            }
+        }
+
+    private:
+        //Not copyable, the buffer is owned by this object
+        BakedPoses(const BakedPoses &);
+        BakedPoses &operator=(const BakedPoses &);
+
+        /**
+        * Header of a cache with the current format
+        */
+        static void fillCacheHeader(BakedCacheHeader &header, uint64_t sourceHash, float fpsModelFactor,
+                                    int numBones, const vector<int> &framesPerAnim){
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, "BKPS", 4);
+            header.version = BAKED_CACHE_VERSION;
+            header.sourceHash = sourceHash;
+            header.fpsModelFactor = fpsModelFactor;
+            header.numBones = numBones;
+            header.numAnimations = framesPerAnim.size();
+            const size_t offset = sizeof(BakedCacheHeader) + framesPerAnim.size() * sizeof(uint32_t);
+            header.dataOffset = (offset + BAKED_POSES_ALIGN - 1) & ~(size_t)(BAKED_POSES_ALIGN - 1);
+        }
+
+        /**
+        * Hash of the palettes of all the animations, as they are stored in the cache
+        */
+        uint64_t hashData(){
+            uint64_t h = 14695981039346656037ULL;
+            for (size_t nAnim = 0; nAnim < animFrames.size(); nAnim++){
+                h = MappedFile::hash(animData[nAnim], getSizeInBytes(nAnim), h);
+            }
+            return h;
+        }
+
+        /**
+        * Returns nFloats aligned to BAKED_POSES_ALIGN. raw is the pointer to free
+        */
+        static float *allocate(size_t nFloats, void *&raw){
+            raw = NULL;
+            if (nFloats == 0) return NULL;
+            //We align by hand to not depend on the platform aligned allocators
+            raw = malloc(nFloats * sizeof(float) + BAKED_POSES_ALIGN - 1);
+            if (raw == NULL) return NULL;
+            return (float *)(((uintptr_t)raw + BAKED_POSES_ALIGN - 1) & ~(uintptr_t)(BAKED_POSES_ALIGN - 1));
+        }
+
+        //Buffer of all the animations when they are allocated together
+        void *rawData;
+        int numBones;
+        //First frame of each animation, NULL if it isn't reserved
+        vector<float *> animData;
+        //Buffer of each animation when they are allocated one by one
+        vector<void *> animRawData;
+        vector<int> animFrames;
+        //Bounding box of each frame of each animation, [nAnim][nFrame * BAKED_BOUNDS_FLOATS]
+        vector<vector<float> > animBounds;
+        //Union of the boxes of the frames of each animation
+        vector<float> clipBounds;
+        //eAnimState of each animation
+        atomic<int> *animState;
+        //Cache file when the palettes are mapped from disk
+        MappedFile cacheFile;
+};
+
+#endif // ANIMATION_H_INCLUDED
@@ -0,0 +1,551 @@
+#ifndef ANIMATIONCLIP_H_INCLUDED
+#define ANIMATIONCLIP_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "Animation.h"
+#include "AffineMath.h"
+#include "CacheStream.h"
+
+using namespace std;
+
+//Max error allowed when removing keys that can be interpolated from their neighbours.
+//Positions are in units of the model, rotations in degrees and scalings are factors
+#define CLIP_POSITION_TOLERANCE 0.0005f
+#define CLIP_ROTATION_TOLERANCE 0.05f
+#define CLIP_SCALING_TOLERANCE 0.0005f
+
+/**
+* Time of a key. The times are kept apart from the values so findKey can search them
+*/
+struct ClipKeyTime {
+    float mTime;
+};
+
+/**
+* Sizes and max reconstruction errors of a clip compared with the animation it was built from
+*/
+struct ClipBuildReport {
+    size_t sourceBytes;
+    uint32_t sourceKeys;
+    //Max error at the times of the original keys. Between them both are interpolated, so
+    //the error can't be much greater
+    float positionError;
+    //Degrees
+    float rotationError;
+    float scalingError;
+
+    ClipBuildReport(){
+        sourceBytes = 0;
+        sourceKeys = 0;
+        positionError = 0;
+        rotationError = 0;
+        scalingError = 0;
+    }
+};
+
+/**
+* Factor of time between the keys at t0 and t1, clamped like the original interpolation
+*/
+inline float clipSegmentFactor(float t0, float t1, float time){
+    if (t1 <= t0) return 0;
+    const float factor = (time - t0) / (t1 - t0);
+    return factor < 0.0f ? 0.0f : (factor > 1.0f ? 1.0f : factor);
+}
+
+/**
+* Indices of the keys to keep, so every removed key is interpolated from the kept ones
+* around it with an error lower than tolerance. keyError(a, b, k) is the error of the key k
+* interpolated between the keys a and b
+*/
+template <class F> void reduceClipKeys(uint32_t numKeys, float tolerance, const F &keyError, vector<uint32_t> &kept){
+    kept.clear();
+    if (numKeys == 0) return;
+
+    //Constant tracks only need one key
+    bool constant = true;
+    for (uint32_t k = 1; k < numKeys && constant; k++){
+        constant = keyError(0, 0, k) <= tolerance;
+    }
+    kept.push_back(0);
+    if (constant) return;
+
+    //Each segment grows while all the keys inside can be removed
+    uint32_t start = 0;
+    for (uint32_t end = 2; end < numKeys; end++){
+        for (uint32_t k = start + 1; k < end; k++){
+            if (keyError(start, end, k) > tolerance){
+                start = end - 1;
+                kept.push_back(start);
+                break;
+            }
+        }
+    }
+    kept.push_back(numKeys - 1);
+}
+
+/**
+* Keys of positions or scalings. Each axis is quantized to 16 bits inside the bounds of the track
+*/
+class ClipVec3Track {
+    public:
+        ClipVec3Track(){
+            for (int axis = 0; axis < 3; axis++){
+                boundsMin[axis] = 0;
+                boundsStep[axis] = 0;
+            }
+        }
+
+        /**
+        * Builds the track from the keys of assimp. T must have mTime and mValue.x, y, z.
+        * Returns the max distance to the original keys
+        */
+        template <class T> float build(const T *keys, uint32_t numKeys, float tolerance){
+            times.clear();
+            values.clear();
+            if (numKeys == 0) return 0;
+
+            vector<float> srcTimes(numKeys), src(numKeys * 3);
+            for (uint32_t i = 0; i < numKeys; i++){
+                srcTimes[i] = keys[i].mTime;
+                src[i * 3] = keys[i].mValue.x;
+                src[i * 3 + 1] = keys[i].mValue.y;
+                src[i * 3 + 2] = keys[i].mValue.z;
+            }
+
+            vector<uint32_t> kept;
+            reduceClipKeys(numKeys, tolerance, [&](uint32_t a, uint32_t b, uint32_t k){
+                const float factor = clipSegmentFactor(srcTimes[a], srcTimes[b], srcTimes[k]);
+                float dist2 = 0;
+                for (int axis = 0; axis < 3; axis++){
+                    const float v = src[a * 3 + axis] + factor * (src[b * 3 + axis] - src[a * 3 + axis]);
+                    dist2 += (v - src[k * 3 + axis]) * (v - src[k * 3 + axis]);
+                }
+                return sqrtf(dist2);
+            }, kept);
+
+            for (int axis = 0; axis < 3; axis++){
+                float lo = src[kept[0] * 3 + axis], hi = lo;
+                for (size_t i = 1; i < kept.size(); i++){
+                    lo = min(lo, src[kept[i] * 3 + axis]);
+                    hi = max(hi, src[kept[i] * 3 + axis]);
+                }
+                boundsMin[axis] = lo;
+                boundsStep[axis] = (hi - lo) / 65535.0f;
+            }
+
+            for (size_t i = 0; i < kept.size(); i++){
+                ClipKeyTime time;
+                time.mTime = srcTimes[kept[i]];
+                times.push_back(time);
+                for (int axis = 0; axis < 3; axis++){
+                    const float q = boundsStep[axis] > 0 ? (src[kept[i] * 3 + axis] - boundsMin[axis]) / boundsStep[axis] : 0;
+                    values.push_back((uint16_t)min(65535.0f, max(0.0f, floorf(q + 0.5f))));
+                }
+            }
+            info.init(&times[0], times.size());
+
+            float maxError = 0;
+            uint32_t cursor = 0;
+            for (uint32_t i = 0; i < numKeys; i++){
+                float v[3];
+                sample(srcTimes[i], &cursor, v);
+                float dist2 = 0;
+                for (int axis = 0; axis < 3; axis++){
+                    dist2 += (v[axis] - src[i * 3 + axis]) * (v[axis] - src[i * 3 + axis]);
+                }
+                maxError = max(maxError, sqrtf(dist2));
+            }
+            return maxError;
+        }
+
+        /**
+        * Interpolated value for the time. cursor (optional) keeps the last key used
+        */
+        void sample(float time, uint32_t *cursor, float *out) const {
+            if (times.empty()){
+                out[0] = out[1] = out[2] = 0;
+                return;
+            }
+            if (times.size() == 1){
+                decode(0, out);
+                return;
+            }
+            const uint32_t key = findKey(&times[0], times.size(), time, info, cursor);
+            const float factor = clipSegmentFactor(times[key].mTime, times[key + 1].mTime, time);
+            float start[3], end[3];
+            decode(key, start);
+            decode(key + 1, end);
+            for (int axis = 0; axis < 3; axis++){
+                out[axis] = start[axis] + factor * (end[axis] - start[axis]);
+            }
+        }
+
+        uint32_t getNumKeys() const {return times.size();}
+
+        size_t getSizeInBytes() const {
+            return times.size() * sizeof(ClipKeyTime) + values.size() * sizeof(uint16_t);
+        }
+
+        void write(CacheWriter &writer) const {
+            writer.writeArray(times);
+            writer.writeArray(values);
+            writer.write(boundsMin);
+            writer.write(boundsStep);
+        }
+
+        bool read(CacheReader &reader){
+            reader.readArray(times);
+            reader.readArray(values);
+            reader.read(boundsMin);
+            reader.read(boundsStep);
+            if (!reader.isValid() || values.size() != times.size() * 3) return false;
+            if (!times.empty()) info.init(&times[0], times.size());
+            return true;
+        }
+
+    private:
+        void decode(uint32_t key, float *out) const {
+            for (int axis = 0; axis < 3; axis++){
+                out[axis] = boundsMin[axis] + values[key * 3 + axis] * boundsStep[axis];
+            }
+        }
+
+        vector<ClipKeyTime> times;
+        //Three quantized axes per key
+        vector<uint16_t> values;
+        float boundsMin[3];
+        //Size of each quantization step, 0 if the axis doesn't change
+        float boundsStep[3];
+        KeyTrackInfo info;
+};
+
+/**
+* Keys of rotations stored as 48 bits "smallest three" quaternions: the largest component is
+* dropped and rebuilt from the other three, which are quantized to 15 bits each
+*/
+class ClipRotationTrack {
+    public:
+        /**
+        * Builds the track from the keys of assimp. T must have mTime and mValue.w, x, y, z.
+        * Returns the max angle in degrees to the original keys
+        */
+        template <class T> float build(const T *keys, uint32_t numKeys, float tolerance){
+            times.clear();
+            values.clear();
+            if (numKeys == 0) return 0;
+
+            vector<float> srcTimes(numKeys), src(numKeys * 4);
+            for (uint32_t i = 0; i < numKeys; i++){
+                srcTimes[i] = keys[i].mTime;
+                float *q = &src[i * 4];
+                q[0] = keys[i].mValue.w;
+                q[1] = keys[i].mValue.x;
+                q[2] = keys[i].mValue.y;
+                q[3] = keys[i].mValue.z;
+                const float len = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+                for (int j = 0; len > 0 && j < 4; j++) q[j] /= len;
+            }
+
+            vector<uint32_t> kept;
+            reduceClipKeys(numKeys, tolerance, [&](uint32_t a, uint32_t b, uint32_t k){
+                float q[4];
+                slerp(&src[a * 4], &src[b * 4], clipSegmentFactor(srcTimes[a], srcTimes[b], srcTimes[k]), q);
+                return angle(q, &src[k * 4]);
+            }, kept);
+
+            for (size_t i = 0; i < kept.size(); i++){
+                ClipKeyTime time;
+                time.mTime = srcTimes[kept[i]];
+                times.push_back(time);
+                uint16_t packed[3];
+                encode(&src[kept[i] * 4], packed);
+                values.insert(values.end(), packed, packed + 3);
+            }
+            info.init(&times[0], times.size());
+
+            float maxError = 0;
+            uint32_t cursor = 0;
+            for (uint32_t i = 0; i < numKeys; i++){
+                float q[4];
+                sample(srcTimes[i], &cursor, q);
+                maxError = max(maxError, angle(q, &src[i * 4]));
+            }
+            return maxError;
+        }
+
+        /**
+        * Interpolated unit quaternion (w, x, y, z) for the time. cursor (optional) keeps the last key used
+        */
+        void sample(float time, uint32_t *cursor, float *out) const {
+            if (times.empty()){
+                out[0] = 1;
+                out[1] = out[2] = out[3] = 0;
+                return;
+            }
+            if (times.size() == 1){
+                decode(&values[0], out);
+                return;
+            }
+            const uint32_t key = findKey(&times[0], times.size(), time, info, cursor);
+            float start[4], end[4];
+            decode(&values[key * 3], start);
+            decode(&values[(key + 1) * 3], end);
+            slerp(start, end, clipSegmentFactor(times[key].mTime, times[key + 1].mTime, time), out);
+        }
+
+        uint32_t getNumKeys() const {return times.size();}
+
+        size_t getSizeInBytes() const {
+            return times.size() * sizeof(ClipKeyTime) + values.size() * sizeof(uint16_t);
+        }
+
+        /**
+        * Spherical interpolation by the shortest path, normalized. The same as aiQuaternion::Interpolate
+        */
+        static void slerp(const float *a, const float *b, float factor, float *out){
+            float cosom = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+            float end[4] = {b[0], b[1], b[2], b[3]};
+            if (cosom < 0.0f){
+                cosom = -cosom;
+                for (int j = 0; j < 4; j++) end[j] = -end[j];
+            }
+
+            float sclp, sclq;
+            if ((1.0f - cosom) > 0.0001f){
+                const float omega = acosf(cosom);
+                const float sinom = sinf(omega);
+                sclp = sinf((1.0f - factor) * omega) / sinom;
+                sclq = sinf(factor * omega) / sinom;
+            } else {
+                //Very close, the linear interpolation is enough
+                sclp = 1.0f - factor;
+                sclq = factor;
+            }
+
+            float len2 = 0;
+            for (int j = 0; j < 4; j++){
+                out[j] = sclp * a[j] + sclq * end[j];
+                len2 += out[j] * out[j];
+            }
+            const float invLen = len2 > 0 ? 1.0f / sqrtf(len2) : 0;
+            for (int j = 0; j < 4; j++) out[j] *= invLen;
+        }
+
+        /**
+        * Angle in degrees of the rotation between two unit quaternions
+        */
+        static float angle(const float *a, const float *b){
+            const float sign = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3] < 0 ? -1.0f : 1.0f;
+            double diff2 = 0, sum2 = 0;
+            for (int j = 0; j < 4; j++){
+                diff2 += (a[j] - sign * b[j]) * (a[j] - sign * b[j]);
+                sum2 += (a[j] + sign * b[j]) * (a[j] + sign * b[j]);
+            }
+            //More precise than the acos of the dot product for small angles
+            return 4.0 * atan2(sqrt(diff2), sqrt(sum2)) * 180.0 / 3.14159265358979;
+        }
+
+        /**
+        * Packs a unit quaternion. The index of the dropped component goes in the high bits
+        * of the first two words. q and -q are the same rotation, so the dropped one is positive
+        */
+        static void encode(const float *q, uint16_t *out){
+            int largest = 0;
+            for (int j = 1; j < 4; j++){
+                if (fabsf(q[j]) > fabsf(q[largest])) largest = j;
+            }
+            const float sign = q[largest] < 0 ? -1.0f : 1.0f;
+            //The other components are in [-1/sqrt(2), 1/sqrt(2)]
+            uint16_t small[3];
+            for (int j = 0, n = 0; j < 4; j++){
+                if (j == largest) continue;
+                const float unit = sign * q[j] * 0.70710678f + 0.5f;
+                small[n++] = (uint16_t)min(32767.0f, max(0.0f, floorf(unit * 32767.0f + 0.5f)));
+            }
+            out[0] = small[0] | ((largest >> 1) << 15);
+            out[1] = small[1] | ((largest & 1) << 15);
+            out[2] = small[2];
+        }
+
+        static void decode(const uint16_t *in, float *q){
+            const int largest = ((in[0] >> 15) << 1) | (in[1] >> 15);
+            float sum2 = 0;
+            for (int j = 0, n = 0; j < 4; j++){
+                if (j == largest) continue;
+                q[j] = ((in[n++] & 0x7FFF) / 32767.0f - 0.5f) * 1.41421356f;
+                sum2 += q[j] * q[j];
+            }
+            q[largest] = sqrtf(max(0.0f, 1.0f - sum2));
+        }
+
+        void write(CacheWriter &writer) const {
+            writer.writeArray(times);
+            writer.writeArray(values);
+        }
+
+        bool read(CacheReader &reader){
+            reader.readArray(times);
+            reader.readArray(values);
+            if (!reader.isValid() || values.size() != times.size() * 3) return false;
+            if (!times.empty()) info.init(&times[0], times.size());
+            return true;
+        }
+
+    private:
+        vector<ClipKeyTime> times;
+        //Three packed words per key
+        vector<uint16_t> values;
+        KeyTrackInfo info;
+};
+
+/**
+* Animated node of a clip
+*/
+struct ClipChannel {
+    string nodeName;
+    ClipVec3Track position;
+    ClipRotationTrack rotation;
+    ClipVec3Track scaling;
+};
+
+/**
+* Compact copy of an animation for the runtime. The redundant keys are removed and the rest
+* quantized, so the scene of assimp doesn't need to stay in memory
+*/
+class AnimationClip {
+    public:
+        AnimationClip(){
+            duration = 0;
+            ticksPerSecond = 0;
+        }
+
+        /**
+        * Builds the clip from an aiAnimation, reporting the sizes and the max errors
+        */
+        template <class A> ClipBuildReport build(const A *pAnimation){
+            ClipBuildReport report;
+            duration = pAnimation->mDuration;
+            ticksPerSecond = pAnimation->mTicksPerSecond;
+            channels.clear();
+            channels.resize(pAnimation->mNumChannels);
+            report.sourceBytes = sizeof(*pAnimation) + pAnimation->mNumChannels * sizeof(pAnimation->mChannels[0]);
+
+            for (uint32_t i = 0; i < pAnimation->mNumChannels; i++){
+                const auto *pNodeAnim = pAnimation->mChannels[i];
+                ClipChannel &channel = channels[i];
+                channel.nodeName = pNodeAnim->mNodeName.data;
+                report.positionError = max(report.positionError,
+                    channel.position.build(pNodeAnim->mPositionKeys, pNodeAnim->mNumPositionKeys, CLIP_POSITION_TOLERANCE));
+                report.rotationError = max(report.rotationError,
+                    channel.rotation.build(pNodeAnim->mRotationKeys, pNodeAnim->mNumRotationKeys, CLIP_ROTATION_TOLERANCE));
+                report.scalingError = max(report.scalingError,
+                    channel.scaling.build(pNodeAnim->mScalingKeys, pNodeAnim->mNumScalingKeys, CLIP_SCALING_TOLERANCE));
+
+                report.sourceKeys += pNodeAnim->mNumPositionKeys + pNodeAnim->mNumRotationKeys + pNodeAnim->mNumScalingKeys;
+                report.sourceBytes += sizeof(*pNodeAnim) + pNodeAnim->mNumPositionKeys * sizeof(pNodeAnim->mPositionKeys[0])
+                                    + pNodeAnim->mNumRotationKeys * sizeof(pNodeAnim->mRotationKeys[0])
+                                    + pNodeAnim->mNumScalingKeys * sizeof(pNodeAnim->mScalingKeys[0]);
+            }
+            return report;
+        }
+
+        /**
+        * Returns the index of the channel of the node, or -1 if the node is not animated
+        */
+        int findChannel(const string &nodeName) const {
+            for (size_t i = 0; i < channels.size(); i++){
+                if (channels[i].nodeName == nodeName) return i;
+            }
+            return -1;
+        }
+
+        /**
+        * Translation, rotation (w, x, y, z) and scaling of a channel. cursor (optional) has
+        * KEY_TYPES slots with the last keys used
+        */
+        void sampleChannel(int nChannel, float time, uint32_t *cursor, float *t, float *q, float *s) const {
+            const ClipChannel &channel = channels[nChannel];
+            channel.position.sample(time, cursor != NULL ? &cursor[KEY_POSITION] : NULL, t);
+            channel.rotation.sample(time, cursor != NULL ? &cursor[KEY_ROTATION] : NULL, q);
+            channel.scaling.sample(time, cursor != NULL ? &cursor[KEY_SCALING] : NULL, s);
+        }
+
+        /**
+        * Packed transformation of a channel
+        */
+        void sampleChannelAffine(int nChannel, float time, uint32_t *cursor, float *out) const {
+            float t[3], q[4], s[3];
+            sampleChannel(nChannel, time, cursor, t, q, s);
+            affineFromTRS(t, q, s, out);
+        }
+
+        float getDuration() const {return duration;}
+        float getTicksPerSecond() const {return ticksPerSecond;}
+        int getNumChannels() const {return channels.size();}
+
+        uint32_t getNumKeys() const {
+            uint32_t keys = 0;
+            for (size_t i = 0; i < channels.size(); i++){
+                keys += channels[i].position.getNumKeys() + channels[i].rotation.getNumKeys() + channels[i].scaling.getNumKeys();
+            }
+            return keys;
+        }
+
+        /**
+        * Stores the clip in a cache file
+        */
+        void write(CacheWriter &writer) const {
+            writer.write(duration);
+            writer.write(ticksPerSecond);
+            writer.write((uint32_t)channels.size());
+            for (size_t i = 0; i < channels.size(); i++){
+                writer.writeString(channels[i].nodeName);
+                channels[i].position.write(writer);
+                channels[i].rotation.write(writer);
+                channels[i].scaling.write(writer);
+            }
+        }
+
+        /**
+        * Reads a clip stored by write. Returns false if the data is wrong
+        */
+        bool read(CacheReader &reader){
+            uint32_t numChannels = 0;
+            reader.read(duration);
+            reader.read(ticksPerSecond);
+            reader.read(numChannels);
+            channels.clear();
+            for (uint32_t i = 0; reader.isValid() && i < numChannels; i++){
+                channels.push_back(ClipChannel());
+                ClipChannel &channel = channels.back();
+                if (!reader.readString(channel.nodeName) || !channel.position.read(reader)
+                    || !channel.rotation.read(reader) || !channel.scaling.read(reader)){
+                    return false;
+                }
+            }
+            return reader.isValid();
+        }
+
+        size_t getSizeInBytes() const {
+            size_t bytes = sizeof(*this);
+            for (size_t i = 0; i < channels.size(); i++){
+                bytes += sizeof(ClipChannel) + channels[i].nodeName.size() + channels[i].position.getSizeInBytes()
+                       + channels[i].rotation.getSizeInBytes() + channels[i].scaling.getSizeInBytes();
+            }
+            return bytes;
+        }
+
+    private:
+        //In ticks
+        float duration;
+        //0 if the file doesn't say it
+        float ticksPerSecond;
+        vector<ClipChannel> channels;
+};
+
+#endif // ANIMATIONCLIP_H_INCLUDED
@@ -0,0 +1,213 @@
+#ifndef ANIMATIONCROWD_H_INCLUDED
+#define ANIMATIONCROWD_H_INCLUDED
+
+#include <vector>
+#include <iostream>
+#include <stddef.h>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Model.h"
+
+using namespace std;
+
+//Animations of a model that the crowd shader can play
+#define MAX_CROWD_CLIPS 16
+//Texture unit of the baked poses, after the ones of the meshes
+#define CROWD_POSES_TEXTURE_UNIT 8
+
+/**
+* Attributes of each instance of a crowd, as they are in the instance buffer
+*/
+struct CrowdInstance {
+    //World transform, in the column-major order of glm
+    GLfloat model[16];
+    //Animation played
+    GLfloat nAnim;
+    //Seconds added to the time of the crowd, so the instances aren't synchronized
+    GLfloat timeOffset;
+};
+
+/**
+* Many instances of an animated model drawn with one instanced call per mesh. The baked
+* poses of all the animations are uploaded once to a texture buffer, indexed by
+* [clip][frame][bone], and the vertex shader reads the pose of each instance from
+* there with its clip, time and world matrix from the instance buffer. Nothing is
+* uploaded per frame but the time
+*/
+class AnimationCrowd {
+    public:
+        AnimationCrowd(){
+            model = NULL;
+            posesBuffer = 0;
+            posesTexture = 0;
+            instanceBuffer = 0;
+            numInstances = 0;
+            numBones = 0;
+            numClips = 0;
+            posesBytes = 0;
+        }
+
+        ~AnimationCrowd(){
+            clear();
+        }
+
+        /**
+        * Texture buffers need GL 3.1 and the instanced attributes GL 3.3
+        */
+        static bool isSupported(){
+            return (GLEW_VERSION_3_1 || GLEW_ARB_texture_buffer_object)
+                && (GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays);
+        }
+
+        /**
+        * Uploads the baked poses of the model and creates the VAOs of the instances. The
+        * model has to bake its animations. Returns false if the crowd can't be drawn
+        */
+        bool init(Model *model){
+            clear();
+            if (!isSupported() || model == NULL || !model->hasAnimations()){
+                cout << "AnimationCrowd: the model isn't animated or GL doesn't support texture buffers and instancing" << endl;
+                return false;
+            }
+            if (!model->waitBakedAnimations()){
+                cout << "AnimationCrowd: the model doesn't bake its animations" << endl;
+                return false;
+            }
+
+            BakedPoses &baked = model->getBakedPoses();
+            numBones = baked.getNumBones();
+            numClips = min(model->getNumAnimations(), MAX_CROWD_CLIPS);
+            if (model->getNumAnimations() > MAX_CROWD_CLIPS){
+                cout << "AnimationCrowd: only the first " << MAX_CROWD_CLIPS << " animations can be played" << endl;
+            }
+
+            //Frames of all the clips, one after the other
+            int totalFrames = 0;
+            for (int nAnim = 0; nAnim < numClips; nAnim++){
+                const AnimationClip &clip = model->getClip(nAnim);
+                clipFirstFrame[nAnim] = totalFrames;
+                clipNumFrames[nAnim] = baked.getNumFrames(nAnim);
+                clipTicksPerSecond[nAnim] = clip.getTicksPerSecond() != 0.0f ? clip.getTicksPerSecond() : 25.0f;
+                clipDuration[nAnim] = clip.getDuration();
+                totalFrames += clipNumFrames[nAnim];
+            }
+
+            //Each bone is three RGBA32F texels, the rows of the packed matrix
+            const size_t bytesPerFrame = (size_t)numBones * BAKED_MATRIX_FLOATS * sizeof(GLfloat);
+            GLint maxTexels = 0;
+            glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+            if ((size_t)totalFrames * numBones * 3 > (size_t)maxTexels){
+                cout << "AnimationCrowd: " << totalFrames << " frames don't fit in a texture buffer of "
+                     << maxTexels << " texels" << endl;
+                return false;
+            }
+
+            posesBytes = totalFrames * bytesPerFrame;
+            glGenBuffers(1, &posesBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, posesBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, posesBytes, NULL, GL_STATIC_DRAW);
+            for (int nAnim = 0; nAnim < numClips; nAnim++){
+                glBufferSubData(GL_TEXTURE_BUFFER, clipFirstFrame[nAnim] * bytesPerFrame,
+                                clipNumFrames[nAnim] * bytesPerFrame, baked.getPalette(nAnim, 0));
+            }
+            glGenTextures(1, &posesTexture);
+            glBindTexture(GL_TEXTURE_BUFFER, posesTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, posesBuffer);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+            glGenBuffers(1, &instanceBuffer);
+            for (size_t i = 0; i < model->getMeshes()->size(); i++){
+                vaos.push_back(model->getMeshes()->at(i)->createInstancedVAO(instanceBuffer, sizeof(CrowdInstance),
+                               offsetof(CrowdInstance, model), offsetof(CrowdInstance, nAnim)));
+            }
+
+            this->model = model;
+            cout << "AnimationCrowd: " << numClips << " clips, " << totalFrames << " frames, "
+                 << posesBytes / 1024 << " KB of poses in the GPU" << endl;
+            return true;
+        }
+
+        /**
+        * Replaces the instances of the crowd
+        */
+        void setInstances(const vector<CrowdInstance> &instances){
+            if (instanceBuffer == 0) return;
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(CrowdInstance),
+                         instances.empty() ? NULL : &instances[0], GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            numInstances = instances.size();
+        }
+
+        /**
+        * Draws all the instances at the time in seconds. The shader must be in use
+        */
+        void Draw(Shader *shader, GLfloat currentFrame){
+            if (model == NULL || numInstances == 0) return;
+
+            glActiveTexture(GL_TEXTURE0 + CROWD_POSES_TEXTURE_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, posesTexture);
+            glUniform1i(glGetUniformLocation(shader->Program, "gBakedPoses"), CROWD_POSES_TEXTURE_UNIT);
+            glUniform1f(glGetUniformLocation(shader->Program, "time"), currentFrame);
+            glUniform1f(glGetUniformLocation(shader->Program, "fpsFactor"), model->getFpsModelFactor());
+            glUniform1i(glGetUniformLocation(shader->Program, "numBones"), numBones);
+            glUniform1i(glGetUniformLocation(shader->Program, "numClips"), numClips);
+            glUniform1iv(glGetUniformLocation(shader->Program, "clipFirstFrame"), numClips, clipFirstFrame);
+            glUniform1iv(glGetUniformLocation(shader->Program, "clipNumFrames"), numClips, clipNumFrames);
+            glUniform1fv(glGetUniformLocation(shader->Program, "clipTicksPerSecond"), numClips, clipTicksPerSecond);
+            glUniform1fv(glGetUniformLocation(shader->Program, "clipDuration"), numClips, clipDuration);
+
+            model->DrawInstanced(shader, vaos, numInstances);
+
+            glActiveTexture(GL_TEXTURE0 + CROWD_POSES_TEXTURE_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+
+        /**
+        *
+        */
+        void clear(){
+            if (!vaos.empty()) glDeleteVertexArrays(vaos.size(), &vaos[0]);
+            if (instanceBuffer != 0) glDeleteBuffers(1, &instanceBuffer);
+            if (posesTexture != 0) glDeleteTextures(1, &posesTexture);
+            if (posesBuffer != 0) glDeleteBuffers(1, &posesBuffer);
+            vaos.clear();
+            instanceBuffer = posesTexture = posesBuffer = 0;
+            numInstances = 0;
+            numClips = 0;
+            posesBytes = 0;
+            model = NULL;
+        }
+
+        GLsizei getNumInstances(){return numInstances;}
+        size_t getPosesSizeInBytes(){return posesBytes;}
+
+    private:
+        //Not copyable, the GL objects are owned by this object
+        AnimationCrowd(const AnimationCrowd &);
+        AnimationCrowd &operator=(const AnimationCrowd &);
+
+        Model *model;
+        //Baked poses of all the clips and the texture to read them
+        GLuint posesBuffer;
+        GLuint posesTexture;
+        size_t posesBytes;
+        //CrowdInstance of each instance
+        GLuint instanceBuffer;
+        GLsizei numInstances;
+        //VAO of each mesh with the instance attributes
+        vector<GLuint> vaos;
+
+        //Where each clip is in the poses and how its time is converted to frames
+        int numBones;
+        int numClips;
+        GLint clipFirstFrame[MAX_CROWD_CLIPS];
+        GLint clipNumFrames[MAX_CROWD_CLIPS];
+        GLfloat clipTicksPerSecond[MAX_CROWD_CLIPS];
+        GLfloat clipDuration[MAX_CROWD_CLIPS];
+};
+
+#endif // ANIMATIONCROWD_H_INCLUDED
@@ -0,0 +1,125 @@
+#ifndef CACHESTREAM_H_INCLUDED
+#define CACHESTREAM_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+//Alignment of the arrays in the cache files, from the start of the data
+#define CACHE_STREAM_ALIGN 16
+
+/**
+* Builds in memory the data of a cache file. The arrays are stored with their number of
+* elements and aligned, so they can be used from the mapped file without copying them
+*/
+class CacheWriter {
+    public:
+        /**
+        * Trivially copyable values only
+        */
+        template <class T> void write(const T &value){
+            writeBytes(&value, sizeof(T));
+        }
+
+        void writeBytes(const void *bytes, size_t size){
+            data.insert(data.end(), (const char *)bytes, (const char *)bytes + size);
+        }
+
+        void writeString(const string &value){
+            write((uint32_t)value.size());
+            writeBytes(value.data(), value.size());
+        }
+
+        template <class T> void writeArray(const T *values, size_t count){
+            write((uint32_t)count);
+            align();
+            writeBytes(values, count * sizeof(T));
+        }
+
+        template <class T> void writeArray(const vector<T> &values){
+            writeArray(values.empty() ? (const T *)NULL : &values[0], values.size());
+        }
+
+        void align(){
+            data.resize((data.size() + CACHE_STREAM_ALIGN - 1) & ~(size_t)(CACHE_STREAM_ALIGN - 1), 0);
+        }
+
+        const vector<char> &getData(){return data;}
+
+    private:
+        vector<char> data;
+};
+
+/**
+* Reads the data written by CacheWriter. The arrays are returned as pointers inside the
+* data. Reading past the end makes the reader invalid instead of crashing, so a truncated
+* file is detected checking isValid at the end
+*/
+class CacheReader {
+    public:
+        CacheReader(const void *data, size_t size){
+            this->data = (const char *)data;
+            this->size = size;
+            pos = 0;
+            valid = data != NULL;
+        }
+
+        template <class T> bool read(T &value){
+            const void *bytes = readBytes(sizeof(T));
+            if (bytes != NULL) memcpy(&value, bytes, sizeof(T));
+            return bytes != NULL;
+        }
+
+        const void *readBytes(size_t count){
+            if (!valid || count > size - pos){
+                valid = false;
+                return NULL;
+            }
+            const char *bytes = data + pos;
+            pos += count;
+            return bytes;
+        }
+
+        bool readString(string &value){
+            uint32_t length = 0;
+            const char *bytes = read(length) ? (const char *)readBytes(length) : NULL;
+            value.assign(bytes != NULL ? bytes : "", bytes != NULL ? length : 0);
+            return bytes != NULL;
+        }
+
+        /**
+        * Pointer to the elements of an array written by writeArray, and its size in count
+        */
+        template <class T> const T *readArray(uint32_t &count){
+            count = 0;
+            uint32_t n = 0;
+            if (!read(n)) return NULL;
+            pos = (pos + CACHE_STREAM_ALIGN - 1) & ~(size_t)(CACHE_STREAM_ALIGN - 1);
+            if (pos > size || (size_t)n > (size - pos) / sizeof(T)){
+                valid = false;
+                return NULL;
+            }
+            count = n;
+            return (const T *)readBytes((size_t)n * sizeof(T));
+        }
+
+        template <class T> bool readArray(vector<T> &values){
+            uint32_t count = 0;
+            const T *first = readArray<T>(count);
+            values.assign(first, first + count);
+            return valid;
+        }
+
+        bool isValid(){return valid;}
+
+    private:
+        const char *data;
+        size_t size;
+        size_t pos;
+        bool valid;
+};
+
+#endif // CACHESTREAM_H_INCLUDED
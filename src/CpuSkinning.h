@@ -0,0 +1,196 @@
+#ifndef CPUSKINNING_H_INCLUDED
+#define CPUSKINNING_H_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+#include "Mesh.h"
+#include "AffineMath.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+//Vertices skinned by each task of skinVerticesParallel
+#define SKINNING_CHUNK 2048
+//Max difference accepted between the skinnings and the scalar reference. Only the order
+//of the sums changes, so it has to be of rounding
+#define SKINNING_MAX_ERROR 1e-3f
+
+/**
+* Vertices to skin in the CPU. The positions and normals are strided, so they can be read
+* from the Vertex of a mesh or from a packed array of positions. normals can be NULL
+*/
+struct SkinningStreams {
+    const float *positions;
+    //Bytes from one position to the next
+    size_t positionStride;
+    const float *normals;
+    size_t normalStride;
+    const PackedBoneData *bones;
+    int numVertices;
+
+    SkinningStreams(){
+        positions = NULL;
+        positionStride = 0;
+        normals = NULL;
+        normalStride = 0;
+        bones = NULL;
+        numVertices = 0;
+    }
+
+    /**
+    *
+    */
+    SkinningStreams(const vector<Vertex> &vertices, const vector<PackedBoneData> &bones){
+        positions = vertices.empty() ? NULL : &vertices[0].Position.x;
+        positionStride = sizeof(Vertex);
+        normals = vertices.empty() ? NULL : &vertices[0].Normal.x;
+        normalStride = sizeof(Vertex);
+        this->bones = bones.empty() ? NULL : &bones[0];
+        numVertices = bones.size() == vertices.size() ? vertices.size() : 0;
+    }
+
+    /**
+    * Only the positions, there are no normals
+    */
+    SkinningStreams(const vector<glm::vec3> &points, const vector<PackedBoneData> &bones){
+        positions = points.empty() ? NULL : &points[0].x;
+        positionStride = sizeof(glm::vec3);
+        normals = NULL;
+        normalStride = 0;
+        this->bones = bones.empty() ? NULL : &bones[0];
+        numVertices = bones.size() == points.size() ? points.size() : 0;
+    }
+
+    const float *getPosition(int i) const {
+        return (const float *)((const char *)positions + i * positionStride);
+    }
+
+    const float *getNormal(int i) const {
+        return (const float *)((const char *)normals + i * normalStride);
+    }
+};
+
+/**
+* Skins the vertices [begin, end) with the packed palette, like model.vertexshader: the
+* bones of each vertex are blended with their weights and the result transforms the
+* position and the normal. The outputs have 3 floats per vertex, indexed from the first
+* vertex of the streams. outNormals can be NULL. This is the reference of the other
+* versions
+*/
+inline void skinVerticesScalar(const SkinningStreams &in, const float *palette, int begin, int end,
+                               float *outPositions, float *outNormals){
+    for (int v = begin; v < end; v++){
+        const PackedBoneData &bones = in.bones[v];
+        float m[12] = {0};
+        for (int k = 0; k < NUM_BONES_PER_VERTEX; k++){
+            if (bones.Weights[k] == 0) continue;
+            const float weight = bones.Weights[k] * (1.0f / 255.0f);
+            const float *bone = palette + bones.IDs[k] * 12;
+            for (int j = 0; j < 12; j++){
+                m[j] += bone[j] * weight;
+            }
+        }
+
+        const float *p = in.getPosition(v);
+        for (int row = 0; row < 3; row++){
+            outPositions[v * 3 + row] = m[row * 4] * p[0] + m[row * 4 + 1] * p[1] + m[row * 4 + 2] * p[2] + m[row * 4 + 3];
+        }
+        if (outNormals != NULL && in.normals != NULL){
+            const float *n = in.getNormal(v);
+            for (int row = 0; row < 3; row++){
+                outNormals[v * 3 + row] = m[row * 4] * n[0] + m[row * 4 + 1] * n[1] + m[row * 4 + 2] * n[2];
+            }
+        }
+    }
+}
+
+#if defined(AFFINE_SSE)
+/**
+* The three rows of an affine transform times v. The result is in the first three lanes
+*/
+inline __m128 skinTransform(__m128 r0, __m128 r1, __m128 r2, __m128 v){
+    __m128 t0 = _mm_mul_ps(r0, v);
+    __m128 t1 = _mm_mul_ps(r1, v);
+    __m128 t2 = _mm_mul_ps(r2, v);
+    __m128 t3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+    return _mm_add_ps(_mm_add_ps(t0, t1), _mm_add_ps(t2, t3));
+}
+#endif
+
+/**
+* skinVerticesScalar with the widest instruction set available. The blend of the bones
+* uses a 256 bits register for two rows with AVX
+*/
+inline void skinVertices(const SkinningStreams &in, const float *palette, int begin, int end,
+                         float *outPositions, float *outNormals){
+#if defined(AFFINE_SSE)
+    const bool withNormals = outNormals != NULL && in.normals != NULL;
+    float result[4];
+    for (int v = begin; v < end; v++){
+        const PackedBoneData &bones = in.bones[v];
+#if defined(AFFINE_AVX)
+        __m256 r01 = _mm256_setzero_ps();
+        __m128 r2 = _mm_setzero_ps();
+        for (int k = 0; k < NUM_BONES_PER_VERTEX; k++){
+            if (bones.Weights[k] == 0) continue;
+            const float weight = bones.Weights[k] * (1.0f / 255.0f);
+            const float *bone = palette + bones.IDs[k] * 12;
+            r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_loadu_ps(bone), _mm256_set1_ps(weight)));
+            r2 = _mm_add_ps(r2, _mm_mul_ps(_mm_loadu_ps(bone + 8), _mm_set1_ps(weight)));
+        }
+        const __m128 r0 = _mm256_castps256_ps128(r01);
+        const __m128 r1 = _mm256_extractf128_ps(r01, 1);
+#else
+        __m128 r0 = _mm_setzero_ps(), r1 = _mm_setzero_ps(), r2 = _mm_setzero_ps();
+        for (int k = 0; k < NUM_BONES_PER_VERTEX; k++){
+            if (bones.Weights[k] == 0) continue;
+            const __m128 weight = _mm_set1_ps(bones.Weights[k] * (1.0f / 255.0f));
+            const float *bone = palette + bones.IDs[k] * 12;
+            r0 = _mm_add_ps(r0, _mm_mul_ps(_mm_loadu_ps(bone), weight));
+            r1 = _mm_add_ps(r1, _mm_mul_ps(_mm_loadu_ps(bone + 4), weight));
+            r2 = _mm_add_ps(r2, _mm_mul_ps(_mm_loadu_ps(bone + 8), weight));
+        }
+#endif
+        const float *p = in.getPosition(v);
+        _mm_storeu_ps(result, skinTransform(r0, r1, r2, _mm_set_ps(1.0f, p[2], p[1], p[0])));
+        memcpy(outPositions + v * 3, result, 3 * sizeof(float));
+        if (withNormals){
+            const float *n = in.getNormal(v);
+            _mm_storeu_ps(result, skinTransform(r0, r1, r2, _mm_set_ps(0.0f, n[2], n[1], n[0])));
+            memcpy(outNormals + v * 3, result, 3 * sizeof(float));
+        }
+    }
+#else
+    skinVerticesScalar(in, palette, begin, end, outPositions, outNormals);
+#endif
+}
+
+/**
+* skinVertices of all the vertices, split in chunks between the threads of the pool
+*/
+inline void skinVerticesParallel(const SkinningStreams &in, const float *palette, float *outPositions,
+                                 float *outNormals, ThreadPool &pool = ThreadPool::getDefault()){
+    pool.parallelFor(in.numVertices, SKINNING_CHUNK, [&](int begin, int end){
+        skinVertices(in, palette, begin, end, outPositions, outNormals);
+    });
+}
+
+/**
+* Max difference between two skinnings, relative to the values bigger than 1
+*/
+inline float maxSkinningError(const vector<float> &positions, const vector<float> &refPositions,
+                              const vector<float> &normals, const vector<float> &refNormals){
+    float maxError = 0;
+    for (size_t j = 0; j < refPositions.size(); j++){
+        maxError = max(maxError, fabsf(positions[j] - refPositions[j]) / max(1.0f, fabsf(refPositions[j])));
+        maxError = max(maxError, fabsf(normals[j] - refNormals[j]) / max(1.0f, fabsf(refNormals[j])));
+    }
+    return maxError;
+}
+
+#endif // CPUSKINNING_H_INCLUDED
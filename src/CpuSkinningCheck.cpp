@@ -0,0 +1,112 @@
+// Std. Includes
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <stdlib.h>
+#include <math.h>
+
+// Skinning
+#include "CpuSkinning.h"
+
+/**
+* Checks the CPU skinning without GL nor models, so it runs in machines without GPU. The
+* SIMD and parallel versions skin random vertices with a random palette and are compared
+* with the scalar reference. Returns 0 if they match. The arguments are the number of
+* vertices and of bones
+*/
+
+using namespace std;
+
+//Floats of each packed bone transform, the first three rows of the 4x4 matrix
+#define PALETTE_MATRIX_FLOATS 12
+
+float randomFloat(float minValue, float maxValue){
+    return minValue + (maxValue - minValue) * (rand() / (float)RAND_MAX);
+}
+
+/**
+* Random rotation, uniform scale and translation of each bone, packed like the palettes
+*/
+void randomPalette(int numBones, vector<float> &palette){
+    palette.resize(numBones * PALETTE_MATRIX_FLOATS);
+    for (int bone = 0; bone < numBones; bone++){
+        float *m = &palette[bone * PALETTE_MATRIX_FLOATS];
+        float axis[3] = {randomFloat(-1, 1), randomFloat(-1, 1), randomFloat(-1, 1)};
+        const float len = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        for (int i = 0; i < 3; i++) axis[i] = len > 0 ? axis[i] / len : (i == 2 ? 1.0f : 0.0f);
+        const float angle = randomFloat(-3.14159f, 3.14159f), scale = randomFloat(0.5f, 2.0f);
+        const float c = cosf(angle), s = sinf(angle), t = 1 - c;
+        const float x = axis[0], y = axis[1], z = axis[2];
+        const float rotation[9] = {t * x * x + c,     t * x * y - s * z, t * x * z + s * y,
+                                   t * x * y + s * z, t * y * y + c,     t * y * z - s * x,
+                                   t * x * z - s * y, t * y * z + s * x, t * z * z + c};
+        for (int row = 0; row < 3; row++){
+            for (int col = 0; col < 3; col++){
+                m[row * 4 + col] = rotation[row * 3 + col] * scale;
+            }
+            m[row * 4 + 3] = randomFloat(-10, 10);
+        }
+    }
+}
+
+/**
+* Random vertices with up to NUM_BONES_PER_VERTEX bones each
+*/
+void randomVertices(int numVertices, int numBones, vector<Vertex> &vertices, vector<PackedBoneData> &bones){
+    vertices.resize(numVertices);
+    bones.resize(numVertices);
+    for (int v = 0; v < numVertices; v++){
+        vertices[v].Position = glm::vec3(randomFloat(-100, 100), randomFloat(-100, 100), randomFloat(-100, 100));
+        vertices[v].Normal = glm::normalize(glm::vec3(randomFloat(-1, 1), randomFloat(-1, 1), randomFloat(-1, 1) + 2.0f));
+        VertexBoneData weights;
+        const int used = 1 + rand() % NUM_BONES_PER_VERTEX;
+        for (int i = 0; i < used; i++){
+            weights.AddBoneData(rand() % numBones, randomFloat(0.05f, 1.0f));
+        }
+        bones[v].Pack(weights);
+    }
+}
+
+int main(int argc, char *argv[]){
+    const int numVertices = argc > 1 ? atoi(argv[1]) : 100000;
+    const int numBones = argc > 2 ? atoi(argv[2]) : MAX_BONES;
+    if (numVertices <= 0 || numBones <= 0 || numBones > 256){
+        cout << "Usage: CpuSkinningCheck [vertices] [bones, up to 256]" << endl;
+        return 2;
+    }
+    srand(1);
+
+    vector<Vertex> vertices;
+    vector<PackedBoneData> bones;
+    vector<float> palette;
+    randomVertices(numVertices, numBones, vertices, bones);
+    randomPalette(numBones, palette);
+    const SkinningStreams streams(vertices, bones);
+
+    const size_t numFloats = (size_t)numVertices * 3;
+    vector<float> refPositions(numFloats), refNormals(numFloats), positions(numFloats), normals(numFloats);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    skinVerticesScalar(streams, &palette[0], 0, numVertices, &refPositions[0], &refNormals[0]);
+    const double msScalar = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    skinVertices(streams, &palette[0], 0, numVertices, &positions[0], &normals[0]);
+    const double msSimd = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    const float errorSimd = maxSkinningError(positions, refPositions, normals, refNormals);
+
+    fill(positions.begin(), positions.end(), 0.0f);
+    fill(normals.begin(), normals.end(), 0.0f);
+    start = chrono::steady_clock::now();
+    skinVerticesParallel(streams, &palette[0], &positions[0], &normals[0]);
+    const double msParallel = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    const float errorParallel = maxSkinningError(positions, refPositions, normals, refNormals);
+
+    const bool valid = errorSimd < SKINNING_MAX_ERROR && errorParallel < SKINNING_MAX_ERROR;
+    cout << "CPU skinning of " << numVertices << " random vertices with " << numBones << " bones:" << endl;
+    cout << "  scalar: " << msScalar << " ms" << endl;
+    cout << "  " << AFFINE_KERNEL_NAME << ": " << msSimd << " ms, max difference " << errorSimd << endl;
+    cout << "  " << AFFINE_KERNEL_NAME << " in " << ThreadPool::getDefault().getNumWorkers() + 1 << " threads: "
+         << msParallel << " ms, max difference " << errorParallel << endl;
+    cout << (valid ? "OK" : "FAILED") << endl;
+    return valid ? 0 : 1;
+}
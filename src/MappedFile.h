@@ -0,0 +1,142 @@
+#ifndef MAPPEDFILE_H_INCLUDED
+#define MAPPEDFILE_H_INCLUDED
+
+#include <string>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif // _WIN32
+
+using namespace std;
+
+/**
+* File mapped in memory. The mapping is copy on write, so the data can be
+* modified without changing the file
+*/
+class MappedFile {
+    public:
+        MappedFile(){
+            data = NULL;
+            size = 0;
+#ifdef _WIN32
+            hFile = INVALID_HANDLE_VALUE;
+            hMapping = NULL;
+#endif // _WIN32
+        }
+
+        ~MappedFile(){
+            close();
+        }
+
+        /**
+        * Maps the whole file. Returns false if it doesn't exist or it's empty
+        */
+        bool open(const string &path){
+            close();
+#ifdef _WIN32
+            hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (hFile == INVALID_HANDLE_VALUE) return false;
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0){
+                close();
+                return false;
+            }
+            hMapping = CreateFileMappingA(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+            if (hMapping == NULL){
+                close();
+                return false;
+            }
+            data = MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+            if (data == NULL){
+                close();
+                return false;
+            }
+            size = fileSize.QuadPart;
+#else
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0){
+                ::close(fd);
+                return false;
+            }
+            void *mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            //The mapping keeps the file open
+            ::close(fd);
+            if (mapping == MAP_FAILED) return false;
+            data = mapping;
+            size = st.st_size;
+#endif // _WIN32
+            return true;
+        }
+
+        /**
+        *
+        */
+        void close(){
+#ifdef _WIN32
+            if (data != NULL) UnmapViewOfFile(data);
+            if (hMapping != NULL) CloseHandle(hMapping);
+            if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+            hFile = INVALID_HANDLE_VALUE;
+            hMapping = NULL;
+#else
+            if (data != NULL) munmap(data, size);
+#endif // _WIN32
+            data = NULL;
+            size = 0;
+        }
+
+        bool isOpen(){return data != NULL;}
+        void *getData(){return data;}
+        size_t getSize(){return size;}
+
+        /**
+        * FNV-1a hash of a block of memory, consuming 8 bytes per step
+        */
+        static uint64_t hash(const void *buffer, size_t len, uint64_t seed = 14695981039346656037ULL){
+            const uint64_t prime = 1099511628211ULL;
+            const unsigned char *bytes = (const unsigned char *)buffer;
+            uint64_t h = seed;
+            size_t i = 0;
+            for (; i + 8 <= len; i += 8){
+                uint64_t word;
+                memcpy(&word, bytes + i, 8);
+                h = (h ^ word) * prime;
+            }
+            for (; i < len; i++){
+                h = (h ^ bytes[i]) * prime;
+            }
+            return h;
+        }
+
+        /**
+        * Hash of the contents of a file. Returns 0 if it can't be read
+        */
+        static uint64_t hashFile(const string &path){
+            MappedFile file;
+            if (!file.open(path)) return 0;
+            return hash(file.getData(), file.getSize());
+        }
+
+    private:
+        //Not copyable, the mapping is owned by this object
+        MappedFile(const MappedFile &);
+        MappedFile &operator=(const MappedFile &);
+
+        void *data;
+        size_t size;
+#ifdef _WIN32
+        HANDLE hFile;
+        HANDLE hMapping;
+#endif // _WIN32
+};
+
+#endif // MAPPEDFILE_H_INCLUDED
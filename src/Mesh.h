@@ -19,9 +19,24 @@ using namespace std;
 #include "ogldev_math_3d.h"
 
 #include "common/structs.h"
+#include "SkinnedCache.h"
 
 #define NUM_BONES_PER_VERTEX 4
 static const int MAX_BONES = 100;
+//Bones of the dual quaternion skinning. They use 2 vec4 each instead of 3, so more bones
+//fit in the same uniforms
+static const int MAX_BONES_DQ = 150;
+
+//CPU copies of the meshes kept after uploading them to GL
+enum eMeshResidency {
+    //Everything, the meshes can be modified and uploaded again
+    RESIDENCY_KEEP_ALL = 0,
+    //Only positions, indices and bones, to build physic shapes from the model and to
+    //skin it in the CPU
+    RESIDENCY_PHYSICS,
+    //Nothing, only the GL buffers
+    RESIDENCY_RELEASE_ALL
+};
 
 struct Texture {
     GLuint id;
@@ -38,20 +53,19 @@ struct Texture {
 struct BoneInfo{
 
 //    glm::mat4 BoneOffset;
-//    glm::mat4 FinalTransformation;
 
     Matrix4f BoneOffset;
-    Matrix4f FinalTransformation;
 
     BoneInfo()
     {
 //        BoneOffset = glm::mat4();
-//        FinalTransformation = glm::mat4();
         BoneOffset.SetZero();
-        FinalTransformation.SetZero();
     }
 };
 
+/**
+* Bones of a vertex while the model is loaded. They are sent to GL as PackedBoneData
+*/
 struct VertexBoneData
 {
     uint32_t IDs[NUM_BONES_PER_VERTEX];
@@ -73,20 +87,65 @@ struct VertexBoneData
     }
 
     /**
-    *
+    * With more bones than we have space for, the smallest weights are dropped. Returns
+    * false if one was dropped. Pack renormalises the weights kept
     */
-    void AddBoneData(uint32_t BoneID, float Weight){
+    bool AddBoneData(uint32_t BoneID, float Weight){
+        uint32_t smallest = 0;
         for (uint32_t i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(IDs) ; i++) {
             if (Weights[i] == 0.0) {
                 IDs[i]     = BoneID;
                 Weights[i] = Weight;
-                return;
+                return true;
             }
+            if (Weights[i] < Weights[smallest]) smallest = i;
+        }
+        if (Weight > Weights[smallest]){
+            IDs[smallest]     = BoneID;
+            Weights[smallest] = Weight;
         }
-        // should never get here - more bones than we have space for
-        assert(0);
+        return false;
+    }
+
+};
+
+/**
+* Bones of a vertex as sent to GL: 8 bytes instead of the 32 of VertexBoneData. The IDs are
+* bytes, enough for MAX_BONES_DQ, and the weights are normalized bytes that add up to 255
+*/
+struct PackedBoneData
+{
+    uint8_t IDs[NUM_BONES_PER_VERTEX];
+    uint8_t Weights[NUM_BONES_PER_VERTEX];
+
+    PackedBoneData()
+    {
+        ZERO_MEM(IDs);
+        ZERO_MEM(Weights);
     }
 
+    /**
+    * Quantizes the weights, renormalising them so they still add up to 1
+    */
+    void Pack(const VertexBoneData &bones){
+        float total = 0;
+        uint32_t largest = 0;
+        for (uint32_t i = 0 ; i < NUM_BONES_PER_VERTEX ; i++) {
+            total += bones.Weights[i];
+            if (bones.Weights[i] > bones.Weights[largest]) largest = i;
+        }
+
+        int sum = 0;
+        for (uint32_t i = 0 ; i < NUM_BONES_PER_VERTEX ; i++) {
+            assert(bones.IDs[i] < 256);
+            IDs[i] = bones.IDs[i];
+            Weights[i] = total > 0 ? (uint8_t)(bones.Weights[i] / total * 255.0f + 0.5f) : 0;
+            sum += Weights[i];
+        }
+        //The rounding error goes to the largest one
+        if (total > 0)
+            Weights[largest] += 255 - sum;
+    }
 };
 
 
@@ -115,6 +174,9 @@ struct VertexBoneData
 #define BONE_WEIGHT_LOCATION 4
 #define TANGENT_LOCATION     5
 #define BITTANGENT_LOCATION  6
+//Attributes of each instance in the instanced draws. The matrix takes 8 to 11
+#define INSTANCE_ANIM_LOCATION   7
+#define INSTANCE_MATRIX_LOCATION 8
 
 class Mesh {
 private:
@@ -125,10 +187,10 @@ public:
     vector<Vertex> vertices;
     vector<GLuint> indices;
     vector<Texture> textures;
-    vector<VertexBoneData> Bones;
+    vector<PackedBoneData> Bones;
 
 
-    vector<VertexBoneData> * getBones(){
+    vector<PackedBoneData> * getBones(){
         return &Bones;
     }
 
@@ -140,6 +202,65 @@ public:
         return &indices;
     }
 
+    /**
+    * Number of vertex positions in CPU memory, kept with all the vertices or alone
+    */
+    uint32_t getNumPositions(){
+        return residency == RESIDENCY_KEEP_ALL ? vertices.size() : positions.size();
+    }
+
+    const glm::vec3 &getPosition(uint32_t i){
+        return residency == RESIDENCY_KEEP_ALL ? vertices[i].Position : positions[i];
+    }
+
+    int getResidency(){
+        return residency;
+    }
+
+    /**
+    * Positions kept with RESIDENCY_PHYSICS
+    */
+    const vector<glm::vec3> &getPositions(){
+        return positions;
+    }
+
+    /**
+    * Releases the CPU copies of the data already uploaded that the policy doesn't keep.
+    * It can only release more data, never get it back
+    */
+    void setResidency(int residency){
+        if (residency <= this->residency) return;
+        if (this->residency == RESIDENCY_KEEP_ALL && residency == RESIDENCY_PHYSICS){
+            positions.resize(vertices.size());
+            for (size_t i = 0; i < vertices.size(); i++){
+                positions[i] = vertices[i].Position;
+            }
+        }
+        if (residency == RESIDENCY_RELEASE_ALL){
+            vector<glm::vec3>().swap(positions);
+            vector<GLuint>().swap(indices);
+            vector<PackedBoneData>().swap(Bones);
+        }
+        //Swapping with an empty vector frees the memory, clear doesn't
+        vector<Vertex>().swap(vertices);
+        this->residency = residency;
+    }
+
+    /**
+    * Bytes of the mesh in CPU memory
+    */
+    size_t getCpuSizeInBytes(){
+        return vertices.capacity() * sizeof(Vertex) + positions.capacity() * sizeof(glm::vec3)
+             + indices.capacity() * sizeof(GLuint) + Bones.capacity() * sizeof(PackedBoneData);
+    }
+
+    /**
+    * Bytes of the buffers uploaded to GL
+    */
+    size_t getGpuSizeInBytes(){
+        return gpuBytes;
+    }
+
     void setName(string var){
         name = var;
     }
@@ -150,13 +271,23 @@ public:
 
     /*  Functions  */
     // Constructor
-    Mesh(){};
+    Mesh(){
+        this->precomputedTexture.texLocId = NULL;
+        this->precomputedTexture.program = 0;
+        this->otherTexture.texLocId = NULL;
+        this->otherTexture.program = 0;
+        this->hasBones = false;
+        this->residency = RESIDENCY_KEEP_ALL;
+        this->numIndices = 0;
+        this->numVertices = 0;
+        this->gpuBytes = 0;
+    };
 
     /**
     *
     */
     Mesh(vector<Vertex> *vertices, vector<GLuint> *indices, vector<Texture> *textures,
-         vector<VertexBoneData> *Bones, Shader *shader)
+         vector<PackedBoneData> *Bones, Shader *shader)
     {
         this->vertices.clear();
         this->indices.clear();
@@ -167,12 +298,20 @@ public:
         this->indices.assign(indices->begin(),indices->end());
         this->textures.assign(textures->begin(),textures->end());
         this->Bones.assign(Bones->begin(),Bones->end());
+        this->initMesh(shader);
+    }
 
-        this->precomputedTexture.texLocId = NULL;
-        // Now that we have all the required data, set the vertex buffers and its attribute pointers.
-        this->setupMesh();
-        //And assign some array to locations of shader variables. boost in fps
-        this->preprocessMesh(shader);
+    /**
+    * Takes the vectors without copying them, they are left empty
+    */
+    Mesh(vector<Vertex> &&vertices, vector<GLuint> &&indices, vector<Texture> &&textures,
+         vector<PackedBoneData> &&Bones, Shader *shader)
+    {
+        this->vertices.swap(vertices);
+        this->indices.swap(indices);
+        this->textures.swap(textures);
+        this->Bones.swap(Bones);
+        this->initMesh(shader);
     }
 
     /**
@@ -183,18 +322,20 @@ public:
     }
 
     /**
-    * Render the mesh
+    * Render the mesh. With a vao, the vertices are read from it instead of from the
+    * buffers of the mesh. With instances, they are drawn with only one call
     */
-    void Draw(Shader *shader){
+    void Draw(Shader *shader, GLuint vao = 0, GLsizei instances = 0){
         GLuint opaqueNr = 0;
         GLuint normalNr = 0;
+        TextureShaderInfo &info = getShaderInfo(shader);
 
         // Bind appropriate textures
         for(GLuint i = 0; i < this->textures.size(); i++)
         {
             glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
             // Now set the sampler to the correct texture unit
-            glUniform1i(this->precomputedTexture.texLocId[i], i);
+            glUniform1i(info.texLocId[i], i);
             // And finally bind the texture
             glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
 
@@ -206,13 +347,16 @@ public:
         }
 
         // Also set each mesh's shininess property to a default value (if you want you could extend this to another mesh property and possibly change this value)
-        glUniform1f(this->precomputedTexture.material_shininess, 16.0f);
-        glUniform1i(this->precomputedTexture.isOpaque, opaqueNr > 0);
-        glUniform1i(this->precomputedTexture.isTexNormal, normalNr > 0);
+        glUniform1f(info.material_shininess, 16.0f);
+        glUniform1i(info.isOpaque, opaqueNr > 0);
+        glUniform1i(info.isTexNormal, normalNr > 0);
 
         // Draw mesh
-        glBindVertexArray(this->VAO);
-        glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(vao != 0 ? vao : this->VAO);
+        if (instances > 0)
+            glDrawElementsInstanced(GL_TRIANGLES, this->numIndices, GL_UNSIGNED_INT, 0, instances);
+        else
+            glDrawElements(GL_TRIANGLES, this->numIndices, GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
 
         // Always good practice to set everything back to defaults once configured.
@@ -222,6 +366,96 @@ public:
         }
     }
 
+    /**
+    * Sends each vertex once as a point, for the transform feedback that skins them
+    */
+    void DrawVertices(){
+        glBindVertexArray(this->VAO);
+        glDrawArrays(GL_POINTS, 0, this->numVertices);
+        glBindVertexArray(0);
+    }
+
+    /**
+    * VAO that reads the position and normal from the skinned vertices written in buffer,
+    * starting at offset, and the rest of the attributes from the mesh
+    */
+    GLuint createSkinnedVAO(GLuint buffer, GLintptr offset){
+        GLuint vao;
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glEnableVertexAttribArray(POSITION_LOCATION);
+        glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, SKINNED_VERTEX_FLOATS * sizeof(GLfloat), (GLvoid*)offset);
+        glEnableVertexAttribArray(NORMAL_LOCATION);
+        glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, SKINNED_VERTEX_FLOATS * sizeof(GLfloat), (GLvoid*)(offset + 3 * sizeof(GLfloat)));
+
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glEnableVertexAttribArray(TEX_COORD_LOCATION);
+        glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+        glEnableVertexAttribArray(TANGENT_LOCATION);
+        glVertexAttribPointer(TANGENT_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Tangent));
+        glEnableVertexAttribArray(BITTANGENT_LOCATION);
+        glVertexAttribPointer(BITTANGENT_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Bittangent));
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+        glBindVertexArray(0);
+        return vao;
+    }
+
+    /**
+    * VAO with all the attributes of the mesh and the ones of each instance, read from
+    * instanceBuffer: a mat4 starting in INSTANCE_MATRIX_LOCATION and a vec2 in
+    * INSTANCE_ANIM_LOCATION
+    */
+    GLuint createInstancedVAO(GLuint instanceBuffer, GLsizei stride, GLintptr matrixOffset, GLintptr animOffset){
+        GLuint vao;
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glEnableVertexAttribArray(POSITION_LOCATION);
+        glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+        glEnableVertexAttribArray(NORMAL_LOCATION);
+        glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+        glEnableVertexAttribArray(TEX_COORD_LOCATION);
+        glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+        glEnableVertexAttribArray(TANGENT_LOCATION);
+        glVertexAttribPointer(TANGENT_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Tangent));
+        glEnableVertexAttribArray(BITTANGENT_LOCATION);
+        glVertexAttribPointer(BITTANGENT_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Bittangent));
+
+        if (this->hasBones){
+            glBindBuffer(GL_ARRAY_BUFFER, this->BBO);
+            glEnableVertexAttribArray(BONE_ID_LOCATION);
+            glVertexAttribIPointer(BONE_ID_LOCATION, 4, GL_UNSIGNED_BYTE, sizeof(PackedBoneData), (GLvoid*)offsetof(PackedBoneData, IDs));
+            glEnableVertexAttribArray(BONE_WEIGHT_LOCATION);
+            glVertexAttribPointer(BONE_WEIGHT_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedBoneData), (GLvoid*)offsetof(PackedBoneData, Weights));
+        }
+
+        //One value per instance instead of per vertex. A mat4 takes four locations
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (int col = 0; col < 4; col++){
+            glEnableVertexAttribArray(INSTANCE_MATRIX_LOCATION + col);
+            glVertexAttribPointer(INSTANCE_MATRIX_LOCATION + col, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(matrixOffset + col * 4 * sizeof(GLfloat)));
+            glVertexAttribDivisor(INSTANCE_MATRIX_LOCATION + col, 1);
+        }
+        glEnableVertexAttribArray(INSTANCE_ANIM_LOCATION);
+        glVertexAttribPointer(INSTANCE_ANIM_LOCATION, 2, GL_FLOAT, GL_FALSE, stride, (GLvoid*)animOffset);
+        glVertexAttribDivisor(INSTANCE_ANIM_LOCATION, 1);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+        glBindVertexArray(0);
+        return vao;
+    }
+
+    /**
+    * Vertices in the GL buffers, they may not be in CPU memory
+    */
+    GLsizei getNumVertices(){
+        return numVertices;
+    }
+
 private:
     /*  Render data  */
     GLuint VAO, VBO, EBO;
@@ -229,6 +463,17 @@ private:
     /* Bones data*/
     GLuint BBO;
 
+    //One of eMeshResidency
+    int residency;
+    //Positions of the vertices when the rest of the vertex is released
+    vector<glm::vec3> positions;
+    //Indices drawn, they may not be in CPU memory
+    GLsizei numIndices;
+    //Vertices uploaded
+    GLsizei numVertices;
+    //Size of VBO, EBO and BBO
+    size_t gpuBytes;
+
     struct TextureShaderInfo{
         //char [25] textureName;
         //GLint  texLocId[25];
@@ -236,12 +481,78 @@ private:
         GLint isOpaque;
         GLint isTexNormal;
         GLint material_shininess;
+        //Program where the locations are
+        GLuint program;
     };
 
     TextureShaderInfo precomputedTexture;
+    //Locations in the last shader used that isn't the one of preprocessMesh
+    TextureShaderInfo otherTexture;
+    //The BBO has the bones of the vertices
+    bool hasBones;
+
+    /**
+    * Locations of the uniforms of the textures in the shader
+    */
+    TextureShaderInfo &getShaderInfo(Shader *shader){
+        if (shader->Program == this->precomputedTexture.program)
+            return this->precomputedTexture;
+        if (shader->Program != this->otherTexture.program)
+            lookupLocations(shader, this->otherTexture);
+        return this->otherTexture;
+    }
+
+    /**
+    * Name of the sampler of a type of texture in the shaders
+    */
+    static const char *getSamplerName(GLuint type){
+        switch (type){
+            case aiTextureType_DIFFUSE: return "texture_diffuse";
+            case aiTextureType_SPECULAR: return "texture_specular";
+            case aiTextureType_OPACITY: return "texture_opaque";
+            case aiTextureType_HEIGHT: return "texture_normal";
+            default: return "";
+        }
+    }
+
+    /**
+    *
+    */
+    void lookupLocations(Shader *shader, TextureShaderInfo &info){
+        if (info.texLocId != NULL){
+            delete[] info.texLocId;
+            info.texLocId = NULL;
+        }
+        if (this->textures.size() > 0){
+            info.texLocId = new GLint[this->textures.size()];
+            for(GLuint i = 0; i < this->textures.size(); i++)
+                info.texLocId[i] = glGetUniformLocation(shader->Program, getSamplerName(this->textures[i].type));
+        }
+        info.material_shininess = glGetUniformLocation(shader->Program, "material_shininess");
+        info.isOpaque = glGetUniformLocation(shader->Program, "is_opaque");
+        info.isTexNormal = glGetUniformLocation(shader->Program, "is_tex_normal");
+        info.program = shader->Program;
+    }
 
     /**  Functions    */
     // Initializes all the buffer objects/arrays
+    /**
+    * Uploads the data of the vectors and finds the locations of the shader
+    */
+    void initMesh(Shader *shader){
+        this->precomputedTexture.texLocId = NULL;
+        this->otherTexture.texLocId = NULL;
+        this->otherTexture.program = 0;
+        this->residency = RESIDENCY_KEEP_ALL;
+        this->numIndices = this->indices.size();
+        this->numVertices = this->vertices.size();
+        this->gpuBytes = 0;
+        // Now that we have all the required data, set the vertex buffers and its attribute pointers.
+        this->setupMesh();
+        //And assign some array to locations of shader variables. boost in fps
+        this->preprocessMesh(shader);
+    }
+
     void setupMesh()
     {
         // Create buffers/arrays
@@ -260,6 +571,7 @@ private:
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+        gpuBytes = this->vertices.size() * sizeof(Vertex) + this->indices.size() * sizeof(GLuint);
 
         // Set the vertex attribute pointers
         // Vertex Positions
@@ -272,15 +584,18 @@ private:
         glEnableVertexAttribArray(TEX_COORD_LOCATION);
         glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
 //        cout << "Bones.size() " << Bones.size() << endl;
+        this->hasBones = Bones.size() > 0;
         if (Bones.size() > 0){
             glBindBuffer(GL_ARRAY_BUFFER, BBO);
             glBufferData(GL_ARRAY_BUFFER, sizeof(Bones[0]) * Bones.size(), &Bones[0], GL_STATIC_DRAW);
+            gpuBytes += sizeof(Bones[0]) * Bones.size();
 
             glEnableVertexAttribArray(BONE_ID_LOCATION);
-            glVertexAttribIPointer(BONE_ID_LOCATION, 4, GL_INT, sizeof(VertexBoneData), (GLvoid*)offsetof(VertexBoneData, IDs));
+            glVertexAttribIPointer(BONE_ID_LOCATION, 4, GL_UNSIGNED_BYTE, sizeof(PackedBoneData), (GLvoid*)offsetof(PackedBoneData, IDs));
 
+            //The shader receives the weights already as floats between 0 and 1
             glEnableVertexAttribArray(BONE_WEIGHT_LOCATION);
-            glVertexAttribPointer(BONE_WEIGHT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(VertexBoneData), (GLvoid*)offsetof(VertexBoneData, Weights));
+            glVertexAttribPointer(BONE_WEIGHT_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedBoneData), (GLvoid*)offsetof(PackedBoneData, Weights));
 
             glBindVertexArray(0);
         }
@@ -306,40 +621,24 @@ private:
 
         if (this->textures.size() > 0){
 
-            if (this->precomputedTexture.texLocId != NULL){
-                delete[] this->precomputedTexture.texLocId;
-            }
-
-            this->precomputedTexture.texLocId = new GLint[this->textures.size()];
-
             for(GLuint i = 0; i < this->textures.size(); i++)
             {
                 glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
                 // Retrieve texture number (the N in diffuse_textureN)
 //                stringstream ss;
 //                string number;
-                string name;
                 if(this->textures[i].type == aiTextureType_DIFFUSE){
-                    name = "texture_diffuse";
                     diffuseNr++; // Transfer GLuint to stream
 //                    ss << diffuseNr++; // Transfer GLuint to stream
                 } else if(this->textures[i].type == aiTextureType_SPECULAR){
-                    name = "texture_specular";
                     specularNr++; // Transfer GLuint to stream
 //                    ss << specularNr++; // Transfer GLuint to stream
                 } else if (this->textures[i].type == aiTextureType_OPACITY){
-                    name = "texture_opaque";
                     opaqueNr++; // Transfer GLuint to stream
 //                    ss << opaqueNr++; // Transfer GLuint to stream
                 } else if (this->textures[i].type == aiTextureType_HEIGHT){
-                    name = "texture_normal";
                     normalNr++; // Transfer GLuint to stream
                 }
-
-//                number = ss.str();
-//                // Now set the sampler to the correct texture unit
-//                this->precomputedTexture.texLocId[i] = glGetUniformLocation(shader->Program, (name + number).c_str());
-                this->precomputedTexture.texLocId[i] = glGetUniformLocation(shader->Program, name.c_str());
             }
             cout << "Mesh " << this->getName() << " with "
             << " d:" << diffuseNr
@@ -354,9 +653,7 @@ private:
 
         }
 
-        this->precomputedTexture.material_shininess = glGetUniformLocation(shader->Program, "material_shininess");
-        this->precomputedTexture.isOpaque = glGetUniformLocation(shader->Program, "is_opaque");
-        this->precomputedTexture.isTexNormal = glGetUniformLocation(shader->Program, "is_tex_normal");
+        lookupLocations(shader, this->precomputedTexture);
     }
 
     /**
@@ -374,10 +671,14 @@ private:
         indices.clear();
         textures.clear();
         Bones.clear();
+        positions.clear();
 
         if (this->precomputedTexture.texLocId != NULL){
             delete[] this->precomputedTexture.texLocId;
         }
+        if (this->otherTexture.texLocId != NULL){
+            delete[] this->otherTexture.texLocId;
+        }
     }
 };
 
@@ -13,6 +13,8 @@
 #include <vector>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <chrono>
+#include <algorithm>
 
 #ifdef WIN
     #include <windows.h>
@@ -34,6 +36,13 @@ using namespace std;
 
 #include "Mesh.h"
 #include "Animation.h"
+#include "AnimationClip.h"
+#include "ThreadPool.h"
+#include "AffineMath.h"
+#include "CpuSkinning.h"
+#include "CacheStream.h"
+#include "TextureStreamer.h"
+#include "TextureCache.h"
 #include <common/texture.hpp>
 
 #include "ogldev_math_3d.h"
@@ -49,6 +58,39 @@ using namespace std;
 
 GLint TextureFromFile(const char* path, string directory, GLboolean alpha);
 
+//Version of the mesh cache files. Increase it when the layout of the data or the way of
+//reading it from the scene changes
+#define MESH_CACHE_VERSION 2
+
+/**
+* Header of a mesh cache file. The data is written with CacheWriter after the header,
+* aligned to CACHE_STREAM_ALIGN from the start of the file
+*/
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    //Hash of the model file the cache was made from
+    uint64_t sourceHash;
+    //Hash of the data after the header
+    uint64_t dataHash;
+    //Sizes of the structs stored as they are, so a different build doesn't read them
+    uint32_t vertexSize;
+    uint32_t boneDataSize;
+    uint64_t dataSize;
+    uint32_t dataOffset;
+};
+
+/**
+* Data of a mesh read in the CPU stage of the load, waiting to be uploaded to GL
+*/
+struct PendingMesh {
+    vector<Vertex> vertices;
+    vector<GLuint> indices;
+    vector<PackedBoneData> bones;
+    //Type and path of each texture
+    vector<pair<GLuint, aiString> > textures;
+};
+
 class Model
 {
 public:
@@ -56,28 +98,67 @@ public:
     Model(){
         this->importer = NULL;
         this->mp_scene = NULL;
-        this->bonesTransform = NULL;
         this->triMeshPhis = NULL;
         this->collisionShape = NULL;
         this->physMesh = new btTriangleMesh();
         this->mNumPhysFaces = 0;
+        this->boneUploadCalls = 0;
+        this->interpolateBakedFrames = true;
+        this->pendingBakes = 0;
+        this->poseCacheQuantum = 0;
+        this->m_NumLodBones = 0;
+        this->skinningMode = SKINNING_LINEAR;
+        this->dualQuatScaleWarned = false;
+        initDefaultLodLevels();
+        this->precalculateBonesTransform = BAKE_NONE;
     }
     /**
-    *Constructor, expects a filepath to a 3D model.
+    *Constructor, expects a filepath to a 3D model. precalculateBonesTransform is one of eBakeMode
     */
-    Model(GLchar* path, Shader *shader, float fpsModelFactor = 1, bool precalculateBonesTransform = false){
+    Model(GLchar* path, Shader *shader, float fpsModelFactor = 1, int precalculateBonesTransform = BAKE_NONE, int bakeThreads = 0){
         this->importer = NULL;
         this->mp_scene = NULL;
-        this->bonesTransform = NULL;
         this->triMeshPhis = NULL;
         this->collisionShape = NULL;
         this->physMesh = new btTriangleMesh();
         this->mNumPhysFaces = 0;
-        this->importer = new Assimp::Importer();
+        this->boneUploadCalls = 0;
+        this->interpolateBakedFrames = true;
+        this->pendingBakes = 0;
+        this->poseCacheQuantum = 0;
+        this->m_NumLodBones = 0;
+        this->skinningMode = SKINNING_LINEAR;
+        this->dualQuatScaleWarned = false;
+        initDefaultLodLevels();
+        this->loadData(path, fpsModelFactor, precalculateBonesTransform, bakeThreads);
+        this->finalize(shader);
+    }
+
+    /**
+    * First stage of the load: reads the model and prepares everything that doesn't need GL,
+    * baking the animations if precalculateBonesTransform asks for it. It can run in any
+    * thread, so several models can be read at the same time. Returns false if the model
+    * can't be read
+    */
+    bool loadData(const string &path, float fpsModelFactor = 1, int precalculateBonesTransform = BAKE_NONE, int bakeThreads = 0){
         this->fpsModelFactor = fpsModelFactor;
         this->precalculateBonesTransform = precalculateBonesTransform;
-        this->loadModel(path, shader);
+        this->bakeThreads = bakeThreads;
+        const bool loaded = this->loadModel(path);
+        this->initBones();
+        return loaded;
+    }
+
+    /**
+    * Second stage of the load, in the thread of the GL context: uploads the meshes read by
+    * loadData, loads their textures and finds the locations of the shader
+    */
+    void finalize(Shader *shader){
+        this->uploadMeshes(shader);
         this->preprocessBones(shader);
+        if (!GLCheckError()){
+            cout << "Model " << this->directory << ": GL error while uploading the model" << endl;
+        }
     }
 
     /**
@@ -96,33 +177,33 @@ public:
     */
     float getAnimationTime(GLfloat currentFrame, int nAnim){
         if (getFpsModelFactor() > 0.0){
-            float TicksPerSecond = mp_scene->mAnimations[nAnim]->mTicksPerSecond != 0.0f ?
-            mp_scene->mAnimations[nAnim]->mTicksPerSecond : 25.0f;
+            float TicksPerSecond = m_Clips[nAnim].getTicksPerSecond() != 0.0f ?
+            m_Clips[nAnim].getTicksPerSecond() : 25.0f;
             float TimeInTicks = currentFrame * TicksPerSecond;
-            return fmod(TimeInTicks, mp_scene->mAnimations[nAnim]->mDuration);
+            return fmod(TimeInTicks, m_Clips[nAnim].getDuration());
         } else {
             return 0;
         }
     }
 
     /**
-    *Draws the model, and thus all its meshes
+    *Draws the model, and thus all its meshes. Without baked poses, the pose is shared with
+    *the instances drawn at the same time in the frame. PoseCache::nextFrame must be called
+    *at the start of each frame, or the cache fills up and the poses stop being shared
     */
-    void Draw(Shader *shader, GLfloat currentFrame, int nAnim = 0){
+    void Draw(Shader *shader, GLfloat currentFrame, int nAnim = 0, AnimationCursor *cursor = NULL){
         glUniform1i(m_animLoc, this->getNumAnimations());
+        boneUploadCalls = 1;
 
         if (this->hasAnimations()){
-            if (this->precalculateBonesTransform){
-                int posAnimation = getAnimationTime(currentFrame, nAnim) * getFpsModelFactor();
-                if (bonesTransform != NULL)
-                    for (int BoneIndex=0; BoneIndex < m_NumBones; BoneIndex++){
-                        SetBoneTransform(BoneIndex, bonesTransform[nAnim][posAnimation][BoneIndex]);
-                    }
-            } else {
-                this->BoneTransform(currentFrame, nAnim);
-                for (int i = 0 ; i < m_BoneInfo.size() ; i++) {
-                    SetBoneTransform(i, m_BoneInfo[i].FinalTransformation);
-                }
+            const float *palette = computePose(currentFrame, nAnim, cursor, &m_Palette[0], &m_NodeGlobals[0]);
+            if (palette != NULL && skinningMode == SKINNING_DUAL_QUATERNION){
+                if (!affinePaletteToDualQuats(palette, m_NumBones, &m_DualQuatPalette[0]))
+                    warnDualQuatScale();
+                palette = &m_DualQuatPalette[0];
+            }
+            if (palette != NULL){
+                SetBoneTransforms(palette, m_NumBones);
             }
         }
 
@@ -130,22 +211,348 @@ public:
             this->meshes[i]->Draw(shader);
     }
 
+    /**
+    * Draws the model with the pose calculated by updateInstance. It only uploads the palette
+    */
+    void Draw(Shader *shader, AnimationInstance *instance){
+        glUniform1i(m_animLoc, this->getNumAnimations());
+        boneUploadCalls = 1;
+
+        if (this->hasAnimations() && instance->palette != NULL){
+            SetBoneTransforms(instance->palette, m_NumBones);
+        }
+
+        for(GLuint i = 0; i < this->meshes.size(); i++)
+            this->meshes[i]->Draw(shader);
+    }
+
+    /**
+    * Draws the instances of the model in one call per mesh, with the VAOs of the instance
+    * buffer of each mesh
+    */
+    void DrawInstanced(Shader *shader, const vector<GLuint> &vaos, GLsizei instances){
+        for(GLuint i = 0; i < this->meshes.size() && i < vaos.size(); i++)
+            this->meshes[i]->Draw(shader, vaos[i], instances);
+    }
+
+    /**
+    * Skins the pose calculated by updateInstance into the cache with the transform feedback
+    * of feedbackShader, so the passes drawn with DrawSkinned don't skin the vertices again.
+    * Only the linear skinning is cached. Returns false if the cache can't be used
+    */
+    bool skinToCache(Shader *feedbackShader, AnimationInstance *instance, SkinnedCache &cache){
+        cache.valid = false;
+        if (!this->hasAnimations() || instance->palette == NULL || skinningMode != SKINNING_LINEAR
+            || !SkinnedCache::isSupported()){
+            return false;
+        }
+
+        if (!cache.isCreated()){
+            createSkinnedCache(cache);
+        }
+
+        feedbackShader->Use();
+        assert(m_NumBones <= MAX_BONES);
+        glUniformMatrix3x4fv(glGetUniformLocation(feedbackShader->Program, "gBones"), m_NumBones, GL_FALSE, instance->palette);
+        //Only the vertices are needed, nothing is rasterized
+        glEnable(GL_RASTERIZER_DISCARD);
+        for(GLuint i = 0; i < this->meshes.size(); i++){
+            const GLsizeiptr size = this->meshes[i]->getNumVertices() * SKINNED_VERTEX_FLOATS * sizeof(GLfloat);
+            if (size > 0){
+                glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, cache.buffer, cache.offsets[i], size);
+                glBeginTransformFeedback(GL_POINTS);
+                this->meshes[i]->DrawVertices();
+                glEndTransformFeedback();
+            }
+        }
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        cache.valid = true;
+        return true;
+    }
+
+    /**
+    * Draws the vertices skinned by the last skinToCache. The shader receives them as a
+    * model without animations
+    */
+    void DrawSkinned(Shader *shader, SkinnedCache &cache){
+        glUniform1i(glGetUniformLocation(shader->Program, "nAnim"), 0);
+        boneUploadCalls = 1;
+
+        for(GLuint i = 0; i < this->meshes.size() && i < cache.vaos.size(); i++)
+            this->meshes[i]->Draw(shader, cache.vaos[i]);
+    }
+
+    /**
+    * Calculates the pose of an instance for the time. It doesn't use any state of the model
+    * but the shared caches, so it can be called from several threads at the same time,
+    * each one with a different instance
+    */
+    void updateInstance(AnimationInstance &instance, GLfloat currentFrame, int nAnim = 0, float distance = 0){
+        updateInstancePose(instance, currentFrame, nAnim, distance);
+        //Converted here, in parallel, so Draw only has to upload it
+        if (skinningMode == SKINNING_DUAL_QUATERNION && instance.palette != NULL){
+            instance.dualQuats.resize(m_NumBones * DUAL_QUAT_FLOATS);
+            if (!affinePaletteToDualQuats(instance.palette, m_NumBones, &instance.dualQuats[0]))
+                warnDualQuatScale();
+            instance.palette = &instance.dualQuats[0];
+        }
+    }
+
+    /**
+    * The packed palette of updateInstance, with the level of detail for the distance
+    */
+    void updateInstancePose(AnimationInstance &instance, GLfloat currentFrame, int nAnim, float distance){
+        const float frameDelta = currentFrame - instance.lastFrame;
+        instance.lastFrame = currentFrame;
+        const bool sameAnim = instance.nAnim == nAnim;
+        instance.nAnim = nAnim;
+        instance.palette = NULL;
+        if (!this->hasAnimations() || m_NumBones == 0) return;
+
+        instance.buffer.resize(m_NumBones * BAKED_MATRIX_FLOATS);
+        instance.globals.resize(m_Skeleton.size() * BAKED_MATRIX_FLOATS);
+
+        //The baked poses are already cheap, the LOD is only for the evaluated ones
+        const int level = getLodLevel(distance);
+        const AnimationLod &lod = lodLevels[level];
+        const bool baked = precalculateBonesTransform != BAKE_NONE && bakedPoses.isReady(nAnim);
+        if (baked || (lod.updateEvery <= 1 && !lod.reducedBones)){
+            instance.lodValid = false;
+            instance.palette = computePose(currentFrame, nAnim, &instance.cursor, &instance.buffer[0], &instance.globals[0]);
+            return;
+        }
+
+        instance.prevPalette.resize(m_NumBones * BAKED_MATRIX_FLOATS);
+        instance.nextPalette.resize(m_NumBones * BAKED_MATRIX_FLOATS);
+        const bool valid = instance.lodValid && sameAnim && instance.lodLevel == level
+                           && currentFrame >= instance.prevTime;
+        if (!valid || currentFrame >= instance.nextTime){
+            const float step = max(frameDelta, 0.001f) * max(lod.updateEvery, 1);
+            if (valid && currentFrame < instance.nextTime + step){
+                //Going on from the last pose evaluated
+                instance.prevPalette.swap(instance.nextPalette);
+                instance.prevTime = instance.nextTime;
+            } else {
+                instance.prevTime = currentFrame;
+                evaluateLodPose(instance, currentFrame, nAnim, lod, &instance.prevPalette[0]);
+            }
+            instance.nextTime = instance.prevTime + step;
+            evaluateLodPose(instance, instance.nextTime, nAnim, lod, &instance.nextPalette[0]);
+            instance.lodValid = true;
+            instance.lodLevel = level;
+        }
+
+        const float factor = (currentFrame - instance.prevTime) / (instance.nextTime - instance.prevTime);
+        BakedPoses::blendPalette(&instance.prevPalette[0], &instance.nextPalette[0], min(factor, 1.0f),
+                                 m_NumBones, &instance.buffer[0]);
+        instance.palette = &instance.buffer[0];
+    }
+
+    /**
+    * Full animation near the camera, and less updates and bones as it goes away
+    */
+    void initDefaultLodLevels(){
+        const AnimationLod levels[] = {{0.0f, 1, false}, {20.0f, 2, false}, {40.0f, 4, true}};
+        lodLevels.assign(levels, levels + ARRAY_SIZE_IN_ELEMENTS(levels));
+    }
+
+    /**
+    * Levels of detail of the animation, sorted by distance. The first one must have distance 0
+    */
+    void setLodLevels(const vector<AnimationLod> &levels){
+        if (levels.size() > 0)
+            lodLevels = levels;
+    }
+
+    /**
+    * Index of the level of detail for the distance to the camera
+    */
+    int getLodLevel(float distance){
+        int level = 0;
+        while (level + 1 < (int)lodLevels.size() && distance >= lodLevels[level + 1].distance){
+            level++;
+        }
+        return level;
+    }
+
+    /**
+    * Evaluates the pose of an instance with the bones of the level of detail
+    */
+    void evaluateLodPose(AnimationInstance &instance, GLfloat time, int nAnim, const AnimationLod &lod, float *palette){
+        evaluateSkeleton(getAnimationTime(time, nAnim), nAnim, palette, &instance.globals[0], &instance.cursor,
+                         lod.reducedBones);
+        PoseCache::getStats().bonesEvaluated += lod.reducedBones ? m_NumLodBones : m_NumBones;
+    }
+
+    /**
+    * Returns the palette of the pose for the time, from the baked poses or evaluating it.
+    * scratchPalette and scratchGlobals are used when it can't be shared
+    */
+    const float *computePose(GLfloat currentFrame, int nAnim, AnimationCursor *cursor,
+                             float *scratchPalette, float *scratchGlobals){
+        if (this->precalculateBonesTransform != BAKE_NONE){
+            if (this->precalculateBonesTransform >= BAKE_LAZY && !bakedPoses.isReady(nAnim))
+                bakeAnimation(nAnim);
+            //Until the animation is baked, it's calculated as usual
+            if (bakedPoses.isReady(nAnim))
+                return sampleBakedPoses(getAnimationTime(currentFrame, nAnim), nAnim, scratchPalette);
+        }
+        return evaluatePoseCached(currentFrame, nAnim, cursor, scratchPalette, scratchGlobals);
+    }
+
+    /**
+    * Returns the baked palette for the time in ticks of the animation. If the time is
+    * between two baked frames, both are interpolated in scratchPalette
+    */
+    const float *sampleBakedPoses(float AnimationTime, int nAnim, float *scratchPalette){
+        const int numFrames = bakedPoses.getNumFrames(nAnim);
+        if (numFrames == 0) return NULL;
+
+        const float posAnimation = AnimationTime * getFpsModelFactor();
+        int frame = posAnimation;
+        //Rounding of the animation time could give us one frame more than baked
+        if (frame >= numFrames - 1)
+            return bakedPoses.getPalette(nAnim, numFrames - 1);
+
+        //The last frame is baked at the end of the animation, nearer than the others
+        const float endFrame = min((float)(frame + 1), m_Clips[nAnim].getDuration() * getFpsModelFactor());
+        const float factor = endFrame > frame ? (posAnimation - frame) / (endFrame - frame) : 0;
+        if (!interpolateBakedFrames || factor <= 0.0f)
+            return bakedPoses.getPalette(nAnim, frame);
+
+        BakedPoses::blendPalette(bakedPoses.getPalette(nAnim, frame), bakedPoses.getPalette(nAnim, frame + 1),
+                                 min(factor, 1.0f), m_NumBones, scratchPalette);
+        return scratchPalette;
+    }
+
+    /**
+    * Returns the palette of the pose, evaluating it only if no other instance of the model
+    * has used the same animation and quantized time in this frame. If other thread is
+    * evaluating the same pose, or the cache is full, it's evaluated again in scratchPalette
+    */
+    const float *evaluatePoseCached(GLfloat currentFrame, int nAnim, AnimationCursor *cursor,
+                                    float *scratchPalette, float *scratchGlobals){
+        if (m_NumBones == 0 || m_Skeleton.size() == 0 || nAnim >= getNumAnimations()) return NULL;
+
+        float AnimationTime = getAnimationTime(currentFrame, nAnim);
+        int64_t timeKey;
+        if (poseCacheQuantum > 0){
+            timeKey = (int64_t)floor(AnimationTime / poseCacheQuantum);
+            //All the instances sharing the key must see the same pose
+            AnimationTime = timeKey * poseCacheQuantum;
+        } else {
+            uint32_t bits;
+            memcpy(&bits, &AnimationTime, sizeof(bits));
+            timeKey = bits;
+        }
+
+        bool mustEvaluate = false;
+        float *palette = poseCache.find(nAnim, timeKey, mustEvaluate);
+        if (palette == NULL){
+            palette = scratchPalette;
+            mustEvaluate = true;
+        }
+        if (mustEvaluate){
+            evaluateSkeleton(AnimationTime, nAnim, palette, scratchGlobals, cursor);
+            PoseCache::getStats().bonesEvaluated += m_NumBones;
+            if (palette != scratchPalette)
+                poseCache.setReady(nAnim, timeKey);
+        }
+        return palette;
+    }
+
+    /**
+    * Conservative bounding box (min x, y, z, max x, y, z) in model space of the skinned
+    * vertices for the time of an animation. With the animation baked it's the union of
+    * the two baked frames around the time; if not, the pose is evaluated. Returns false
+    * if the model isn't animated
+    */
+    bool getPoseBounds(int nAnim, GLfloat currentFrame, float *aabb){
+        if (nAnim < 0 || nAnim >= getNumAnimations() || m_NumBones == 0 || m_BoneBounds.empty()) return false;
+
+        const float AnimationTime = getAnimationTime(currentFrame, nAnim);
+        if (bakedPoses.isReady(nAnim) && bakedPoses.getFrameBounds(nAnim, 0) != NULL){
+            const int numFrames = bakedPoses.getNumFrames(nAnim);
+            const int frame = min((int)(AnimationTime * getFpsModelFactor()), numFrames - 1);
+            memcpy(aabb, bakedPoses.getFrameBounds(nAnim, frame), BAKED_BOUNDS_FLOATS * sizeof(float));
+            BakedPoses::mergeBounds(aabb, bakedPoses.getFrameBounds(nAnim, min(frame + 1, numFrames - 1)));
+            return true;
+        }
+
+        vector<float> palette(m_NumBones * BAKED_MATRIX_FLOATS), globals(m_Skeleton.size() * BAKED_MATRIX_FLOATS);
+        evaluateSkeleton(AnimationTime, nAnim, &palette[0], &globals[0]);
+        BakedPoses::poseBounds(&palette[0], m_NumBones, &m_BoneBounds[0], aabb);
+        return true;
+    }
+
+    /**
+    * Union of the bounding boxes of all the baked frames of an animation. Returns false
+    * if it isn't baked yet
+    */
+    bool getClipBounds(int nAnim, float *aabb){
+        if (!bakedPoses.isReady(nAnim) || bakedPoses.getClipBounds(nAnim) == NULL) return false;
+        memcpy(aabb, bakedPoses.getClipBounds(nAnim), BAKED_BOUNDS_FLOATS * sizeof(float));
+        return true;
+    }
+
+    /**
+    * Instances whose animation times are in the same interval of ticks share the pose.
+    * With 0, they must have exactly the same time
+    */
+    void setPoseCacheQuantum(float ticks){
+        poseCacheQuantum = ticks;
+    }
+
+    /**
+    * Without interpolation the baked animations are played frame by frame
+    */
+    void setInterpolateBakedFrames(bool var){
+        interpolateBakedFrames = var;
+    }
+
     /**
     *
     */
     bool hasAnimations(){
-        return (mp_scene != NULL && mp_scene->mNumAnimations > 0);
+        return !m_Clips.empty();
     }
 
     /**
     *
     */
     int getNumAnimations(){
-        if (mp_scene != NULL){
-            return mp_scene->mNumAnimations;
-        } else {
-            return 0;
+        return m_Clips.size();
+    }
+
+    /**
+    *
+    */
+    AnimationClip &getClip(int nAnim){
+        return m_Clips[nAnim];
+    }
+
+    /**
+    *
+    */
+    BakedPoses &getBakedPoses(){
+        return bakedPoses;
+    }
+
+    /**
+    * Bakes the animations not baked yet and waits for the ones being baked in the
+    * background. Returns false if the model doesn't bake its animations
+    */
+    bool waitBakedAnimations(){
+        if (precalculateBonesTransform == BAKE_NONE || !hasAnimations()) return false;
+        for (int nAnim = 0; nAnim < getNumAnimations(); nAnim++){
+            if (!bakedPoses.isReady(nAnim))
+                bakeAnimation(nAnim);
         }
+        while (pendingBakes > 0){
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        return true;
     }
 
     /**
@@ -177,19 +584,221 @@ public:
     }
 
     /**
-    *
+    * cursor (optional) is the state of the keys of the instance being animated
     */
-    void BoneTransform(float TimeInSeconds, int nAnimation){
-        //glm::mat4 Identity = glm::mat4();
-        Matrix4f Identity;
-        Identity.InitIdentity();
-        if (mp_scene != NULL && mp_scene->mNumAnimations > nAnimation){
-            if (!precalculateBonesTransform){
-                ReadNodeHeirarchy(getAnimationTime(TimeInSeconds, nAnimation), mp_scene->mRootNode, Identity);
+    void BoneTransform(float TimeInSeconds, int nAnimation, AnimationCursor *cursor = NULL){
+        if (nAnimation < getNumAnimations()){
+            if (m_Palette.size() > 0 && m_Skeleton.size() > 0){
+                evaluateSkeleton(getAnimationTime(TimeInSeconds, nAnimation), nAnimation, &m_Palette[0], &m_NodeGlobals[0], cursor);
             }
         }
     }
 
+    /**
+    * Bakes again all the frames with 1 to maxThreads threads, printing the time spent
+    */
+    void benchmarkBake(int maxThreads){
+        if (!hasAnimations() || bakedPoses.isEmpty() || precalculateBonesTransform != BAKE_ALL){
+            cout << "benchmarkBake: there are no animations baked at load" << endl;
+            return;
+        }
+
+        double timeOneThread = 0;
+        for (int nThreads = 1; nThreads <= maxThreads; nThreads++){
+            const double ms = bakeAllFrames(nThreads);
+            if (nThreads == 1)
+                timeOneThread = ms;
+            cout << "Bake with " << nThreads << " threads: " << ms << " ms. Speedup: "
+                 << (ms > 0 ? timeOneThread / ms : 0) << "x" << endl;
+        }
+    }
+
+    /**
+    * Compares the bones per second of the original evaluation of the skeleton with the
+    * packed one, sampling all the animations. Also prints the max difference between both
+    */
+    void benchmarkPose(int samplesPerAnim){
+        if (!hasAnimations() || m_NumBones == 0 || m_Skeleton.size() == 0){
+            cout << "benchmarkPose: there are no animations" << endl;
+            return;
+        }
+
+        vector<Matrix4f> pose(m_NumBones), globals(m_Skeleton.size());
+        vector<float> palette(m_NumBones * BAKED_MATRIX_FLOATS), packedGlobals(m_Skeleton.size() * BAKED_MATRIX_FLOATS);
+        double msReference = 0, msPacked = 0;
+        float maxError = 0;
+
+        for (int nAnim = 0; nAnim < getNumAnimations(); nAnim++){
+            const float duration = m_Clips[nAnim].getDuration();
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for (int i = 0; i < samplesPerAnim; i++){
+                evaluateSkeletonReference(duration * i / samplesPerAnim, nAnim, &pose[0], &globals[0]);
+            }
+            msReference += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+            start = chrono::steady_clock::now();
+            for (int i = 0; i < samplesPerAnim; i++){
+                evaluateSkeleton(duration * i / samplesPerAnim, nAnim, &palette[0], &packedGlobals[0]);
+            }
+            msPacked += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+            //The last sample of both is the same pose
+            for (uint32_t bone = 0; bone < m_NumBones; bone++){
+                float packed[BAKED_MATRIX_FLOATS];
+                BakedPoses::store(pose[bone], packed);
+                for (int j = 0; j < BAKED_MATRIX_FLOATS; j++){
+                    maxError = max(maxError, fabsf(packed[j] - palette[bone * BAKED_MATRIX_FLOATS + j]));
+                }
+            }
+        }
+
+        const double bones = (double)m_NumBones * samplesPerAnim * getNumAnimations();
+        cout << "Pose evaluation of " << m_NumBones << " bones:" << endl;
+        cout << "  Matrix4f: " << (msReference > 0 ? bones / msReference * 1000 : 0) << " bones/s" << endl;
+        cout << "  packed 3x4 (" << AFFINE_KERNEL_NAME << "): " << (msPacked > 0 ? bones / msPacked * 1000 : 0)
+             << " bones/s. Max difference: " << maxError << endl;
+    }
+
+    /**
+    * Skinned positions of a mesh, and its normals if they aren't NULL, with a packed
+    * palette of the linear skinning. They are in model space, 3 floats per vertex. The
+    * mesh needs its vertices or, at least, the positions of RESIDENCY_PHYSICS, and then
+    * there are no normals. Returns false if it can't be skinned
+    */
+    bool skinMeshOnCpu(int idMesh, const float *palette, vector<float> &positions, vector<float> *normals = NULL){
+        if (palette == NULL || idMesh < 0 || idMesh >= (int)meshes.size()) return false;
+        Mesh *mesh = meshes[idMesh];
+        const SkinningStreams streams = mesh->getResidency() == RESIDENCY_KEEP_ALL ?
+            SkinningStreams(*mesh->getVertices(), *mesh->getBones()) :
+            SkinningStreams(mesh->getPositions(), *mesh->getBones());
+        if (streams.numVertices == 0) return false;
+
+        positions.resize(streams.numVertices * 3);
+        if (normals != NULL) normals->resize(streams.normals != NULL ? streams.numVertices * 3 : 0);
+        skinVerticesParallel(streams, palette, &positions[0],
+                             normals != NULL && !normals->empty() ? &(*normals)[0] : NULL);
+        return true;
+    }
+
+    /**
+    * Skins the meshes in the CPU with the scalar reference, the SIMD version and the
+    * SIMD version in all the threads, in a pose of each animation. Prints the vertices
+    * per second of each one and the max difference with the reference. The meshes must
+    * still be in CPU memory. Returns false if the difference is too big
+    */
+    bool validateCpuSkinning(int iterations){
+        if (!hasAnimations() || m_NumBones == 0){
+            cout << "validateCpuSkinning: there are no animations" << endl;
+            return true;
+        }
+
+        vector<float> palette(m_NumBones * BAKED_MATRIX_FLOATS), globals(m_Skeleton.size() * BAKED_MATRIX_FLOATS);
+        vector<float> refPositions, refNormals, positions, normals;
+        double msScalar = 0, msSimd = 0, msParallel = 0;
+        size_t skinned = 0;
+        float maxError = 0;
+        for (int nAnim = 0; nAnim < getNumAnimations(); nAnim++){
+            evaluateSkeleton(m_Clips[nAnim].getDuration() * 0.5f, nAnim, &palette[0], &globals[0]);
+
+            for (size_t idMesh = 0; idMesh < meshes.size(); idMesh++){
+                const SkinningStreams streams(*meshes[idMesh]->getVertices(), *meshes[idMesh]->getBones());
+                if (streams.numVertices == 0) continue;
+                const size_t numFloats = streams.numVertices * 3;
+                refPositions.resize(numFloats);
+                refNormals.resize(numFloats);
+                positions.resize(numFloats);
+                normals.resize(numFloats);
+
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                for (int i = 0; i < iterations; i++){
+                    skinVerticesScalar(streams, &palette[0], 0, streams.numVertices, &refPositions[0], &refNormals[0]);
+                }
+                msScalar += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+                start = chrono::steady_clock::now();
+                for (int i = 0; i < iterations; i++){
+                    skinVertices(streams, &palette[0], 0, streams.numVertices, &positions[0], &normals[0]);
+                }
+                msSimd += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                maxError = max(maxError, maxSkinningError(positions, refPositions, normals, refNormals));
+
+                fill(positions.begin(), positions.end(), 0.0f);
+                fill(normals.begin(), normals.end(), 0.0f);
+                start = chrono::steady_clock::now();
+                for (int i = 0; i < iterations; i++){
+                    skinVerticesParallel(streams, &palette[0], &positions[0], &normals[0]);
+                }
+                msParallel += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                maxError = max(maxError, maxSkinningError(positions, refPositions, normals, refNormals));
+                skinned += (size_t)streams.numVertices * iterations;
+            }
+        }
+
+        if (skinned == 0){
+            cout << "validateCpuSkinning: the meshes aren't in CPU memory" << endl;
+            return true;
+        }
+        const bool valid = maxError < SKINNING_MAX_ERROR;
+        cout << "CPU skinning of " << directory << ":" << endl;
+        cout << "  scalar: " << (msScalar > 0 ? skinned / msScalar * 1000 : 0) << " vertices/s" << endl;
+        cout << "  " << AFFINE_KERNEL_NAME << ": " << (msSimd > 0 ? skinned / msSimd * 1000 : 0) << " vertices/s" << endl;
+        cout << "  " << AFFINE_KERNEL_NAME << " in " << ThreadPool::getDefault().getNumWorkers() + 1 << " threads: "
+             << (msParallel > 0 ? skinned / msParallel * 1000 : 0) << " vertices/s" << endl;
+        cout << "  Max difference with the scalar reference: " << maxError << (valid ? " OK" : " FAILED") << endl;
+        return valid;
+    }
+
+    /**
+    * One of eSkinningMode. It must match the vertex shader: model.vertexshader for
+    * SKINNING_LINEAR and model_dq.vertexshader for SKINNING_DUAL_QUATERNION. Returns
+    * false if the model has too many bones for the mode
+    */
+    bool setSkinningMode(int mode){
+        const int maxBones = mode == SKINNING_DUAL_QUATERNION ? MAX_BONES_DQ : MAX_BONES;
+        if ((int)m_NumBones > maxBones){
+            cout << "setSkinningMode: " << m_NumBones << " bones, the limit is " << maxBones << endl;
+            return false;
+        }
+        skinningMode = mode;
+        m_DualQuatPalette.resize(mode == SKINNING_DUAL_QUATERNION ? m_NumBones * DUAL_QUAT_FLOATS : 0);
+        return true;
+    }
+
+    int getSkinningMode(){
+        return skinningMode;
+    }
+
+    /**
+    * Dual quaternions drop the scale of the bones, so the model is deformed. Printed once
+    */
+    void warnDualQuatScale(){
+        if (!dualQuatScaleWarned.exchange(true)){
+            cout << "SKINNING_DUAL_QUATERNION: the palette has bones with scale, it's ignored" << endl;
+        }
+    }
+
+    /**
+    * Bytes of the palette sent to the shader in each Draw
+    */
+    int getBoneUploadBytes(){
+        return hasAnimations() ? m_NumBones * sizeof(float) *
+               (skinningMode == SKINNING_DUAL_QUATERNION ? DUAL_QUAT_FLOATS : BAKED_MATRIX_FLOATS) : 0;
+    }
+
+    /**
+    * GL calls made by the last Draw to send the animation to the shader
+    */
+    int getBoneUploadCalls(){
+        return boneUploadCalls;
+    }
+
+    /**
+    * GL calls that the last Draw would have made sending the bones one by one
+    */
+    int getBoneUploadCallsPerBone(){
+        return hasAnimations() ? 1 + m_NumBones : 1;
+    }
+
     /**
     *
     */
@@ -197,6 +806,55 @@ public:
         return &meshes;
     }
 
+    /**
+    * Releases the CPU copies of the meshes that the policy, one of eMeshResidency, doesn't
+    * keep. The physic shapes built before keep their own copy of the triangles
+    */
+    void setResidency(int residency){
+        const size_t before = getCpuMeshBytes();
+        for (size_t i = 0; i < meshes.size(); i++){
+            meshes[i]->setResidency(residency);
+        }
+        printMemoryReport(before);
+    }
+
+    /**
+    * Bytes of the meshes in CPU memory
+    */
+    size_t getCpuMeshBytes(){
+        size_t bytes = 0;
+        for (size_t i = 0; i < meshes.size(); i++){
+            bytes += meshes[i]->getCpuSizeInBytes();
+        }
+        return bytes;
+    }
+
+    /**
+    * Prints the memory used by the model. cpuMeshBytesBefore is the size of the meshes
+    * before releasing part of them, 0 if nothing was released
+    */
+    void printMemoryReport(size_t cpuMeshBytesBefore = 0){
+        const size_t cpuMeshBytes = getCpuMeshBytes();
+        size_t gpuMeshBytes = 0, clipBytes = 0;
+        for (size_t i = 0; i < meshes.size(); i++){
+            gpuMeshBytes += meshes[i]->getGpuSizeInBytes();
+        }
+        for (size_t i = 0; i < m_Clips.size(); i++){
+            clipBytes += m_Clips[i].getSizeInBytes();
+        }
+
+        cout << "Memory of " << modelPath << ":" << endl;
+        cout << "  meshes in CPU: " << cpuMeshBytes / 1024 << " KB";
+        if (cpuMeshBytesBefore > cpuMeshBytes){
+            cout << ". Released: " << (cpuMeshBytesBefore - cpuMeshBytes) / 1024 << " KB";
+        }
+        cout << endl;
+        cout << "  meshes in GPU: " << gpuMeshBytes / 1024 << " KB" << endl;
+        cout << "  animation clips: " << clipBytes / 1024 << " KB" << endl;
+        cout << "  baked poses: " << bakedPoses.getSizeInBytes() / 1024 << " KB" << (bakedPoses.isMapped() ? " (mapped)" : "") << endl;
+        cout << "  Assimp scene: " << (importer != NULL ? "loaded" : "released") << endl;
+    }
+
     /*  Model Data  */
     vector<Mesh *> meshes;
 
@@ -218,10 +876,49 @@ public:
 private:
 
     string directory;
+    //File the model was loaded from
+    string modelPath;
+    //One reference of the TextureCache for each texture of each mesh
     vector<Texture> textures_loaded;
+    //Meshes read by loadData, waiting for finalize
+    vector<PendingMesh> pendingMeshes;
     map <string, uint32_t>m_BoneMapping;
     vector<BoneInfo> m_BoneInfo;
-    GLuint m_boneLocation[MAX_BONES];
+    //Compact copy of the animations of the scene, which is released after loading
+    vector<AnimationClip> m_Clips;
+    //Nodes of the scene with their parents first
+    vector<SkeletonNode> m_Skeleton;
+    //Channel of each node in each animation, -1 if not animated. [nAnim][nNode]
+    vector<vector<int> > m_NodeChannels;
+    //Scratch packed global transform of each node for the animations evaluated at runtime
+    vector<float> m_NodeGlobals;
+    //Location of the array of bones. All the palette is sent in one call
+    GLuint m_bonesLocation;
+    //Packed pose of the animations evaluated at runtime, ready to upload
+    vector<float> m_Palette;
+    //One of eSkinningMode
+    int skinningMode;
+    //m_Palette converted for SKINNING_DUAL_QUATERNION
+    vector<float> m_DualQuatPalette;
+    //The palette had scale in SKINNING_DUAL_QUATERNION and it has been reported
+    atomic<bool> dualQuatScaleWarned;
+    //Poses evaluated at runtime in this frame, shared by the instances in the same state
+    PoseCache poseCache;
+    float poseCacheQuantum;
+    //Packed BoneOffset of each bone
+    vector<float> m_BoneOffsets;
+    //Box of the vertices moved by each bone in the bind pose, BAKED_BOUNDS_FLOATS per bone
+    vector<float> m_BoneBounds;
+    //Node that moves each bone, -1 if none
+    vector<int> m_BoneNodes;
+    //Bone that moves each bone in the reduced skeleton, -1 if it's evaluated
+    vector<int> m_LodBoneRemap;
+    uint32_t m_NumLodBones;
+    //Levels of detail of the animations sorted by distance
+    vector<AnimationLod> lodLevels;
+    //Packed m_GlobalInverseTransform
+    float m_GlobalInverse[BAKED_MATRIX_FLOATS];
+    int boneUploadCalls;
     GLuint m_animLoc;
     uint32_t m_NumBones;
     int totalFramesModel;
@@ -234,7 +931,14 @@ private:
     Matrix4f m_GlobalInverseTransform;
     const aiScene* mp_scene;
     Assimp::Importer* importer;
-    bool precalculateBonesTransform;
+    //One of eBakeMode
+    int precalculateBonesTransform;
+    //Animations being baked in the background
+    atomic<int> pendingBakes;
+    //Blends the two nearest baked frames, so the animations can be baked with a low fpsModelFactor
+    bool interpolateBakedFrames;
+    //Threads used to bake the animations. 0 uses all the hardware threads
+    int bakeThreads;
 
     int mNumPhysFaces;
 
@@ -242,56 +946,29 @@ private:
 
 
 
-    //We define this matrix to minimize the memory used, instead of a Matrix4f
-    struct matrix4{
-        float aa,ab,ac,ad,
-              ba,bb,bc,bd,
-              ca,cb,cc,cd;
-              //da,db,dc,dd; //0,0,0,1
-
-        matrix4(Matrix4f &mat){
-            aa = mat.m[0][0]; ab = mat.m[0][1]; ac = mat.m[0][2]; ad = mat.m[0][3];
-            ba = mat.m[1][0]; bb = mat.m[1][1]; bc = mat.m[1][2]; bd = mat.m[1][3];
-            ca = mat.m[2][0]; cb = mat.m[2][1]; cc = mat.m[2][2]; cd = mat.m[2][3];
-//            da = mat.m[3][0]; db = mat.m[3][1]; dc = mat.m[3][2]; dd = mat.m[3][3];
-//            cout << mat.m[0][0] << "," << mat.m[0][1] << "," << mat.m[0][2] << "," << mat.m[0][3] << endl;
-//            cout << mat.m[1][0] << "," << mat.m[1][1] << "," << mat.m[1][2] << "," << mat.m[1][3] << endl;
-//            cout << mat.m[2][0] << "," << mat.m[2][1] << "," << mat.m[2][2] << "," << mat.m[2][3] << endl;
-//            cout << mat.m[3][0] << "," << mat.m[3][1] << "," << mat.m[3][2] << "," << mat.m[3][3] << endl;
-//            cout << endl;
-        }
-    };
-    //vector with bones matrix transform, per time and per num of animation
-    //mf_transformBonesFinal[nAnim][posAnimation][BoneIndex]
-//    vector<vector<vector<matrix4 *> > > mf_transformBonesFinal;
-
-    //Creamos un array dinmico de tres dimensiones [nAnim][posAnimation][BoneIndex]
-    matrix4 ****bonesTransform;
+    //Precalculated bone transforms. One contiguous buffer indexed by [nAnim][posAnimation][BoneIndex]
+    BakedPoses bakedPoses;
 
     /**
     *
     */
     void cleanBones(){
-        if (mp_scene != NULL){
-            const int nAnimations = mp_scene->mNumAnimations;
-            if (bonesTransform != NULL){
-                for (int nAnim = 0; nAnim < nAnimations; nAnim++){
-                    const int nFrames = ceil(mp_scene->mAnimations[nAnim]->mDuration * getFpsModelFactor());
-                    for (int nFrame = 0; nFrame < nFrames; nFrame++){
-                        for (int BoneIndex=0; BoneIndex < m_NumBones; BoneIndex++){
-                            delete bonesTransform[nAnim][nFrame][BoneIndex];
-                        }
-                        delete [] bonesTransform[nAnim][nFrame];
-                    }
-                    delete [] bonesTransform[nAnim];
-                }
-                delete [] bonesTransform;
-                bonesTransform = NULL;
-            }
+        //The background bakes write in the buffers we are going to free
+        while (pendingBakes > 0){
+            this_thread::sleep_for(chrono::milliseconds(1));
         }
-
+        bakedPoses.clear();
         m_BoneMapping.clear();
         m_BoneInfo.clear();
+        m_BoneOffsets.clear();
+        m_BoneBounds.clear();
+        m_BoneNodes.clear();
+        m_LodBoneRemap.clear();
+        m_Palette.clear();
+        m_Skeleton.clear();
+        m_NodeChannels.clear();
+        m_NodeGlobals.clear();
+        m_Clips.clear();
     }
 
     /**
@@ -309,7 +986,7 @@ private:
     */
     void cleanTextures(){
         for(GLuint j = 0; j < textures_loaded.size(); j++){
-            glDeleteTextures(1, &this->textures_loaded[j].id);
+            TextureCache::getDefault().release(this->textures_loaded[j].id);
         }
         this->textures_loaded.clear();
     }
@@ -322,17 +999,25 @@ private:
         //aiReleaseImport( mp_scene);
         if (importer != NULL)
             delete importer;
+        importer = NULL;
+        mp_scene = NULL;
     }
 
     /**
-    *
+    * Sends numBones bones to the shader. With SKINNING_LINEAR they are packed matrices, each
+    * row of the packed matrix is a column of the mat3x4 in the shader, so there is no need
+    * to transpose. With SKINNING_DUAL_QUATERNION the real and dual parts are the columns
+    * of a mat2x4
     */
-    void SetBoneTransform(int Index, const Matrix4f& Transform){
-        //cout << "Index: " << Index << endl;
-        assert(Index < MAX_BONES);
-        //Transform.Print();
-        //glUniformMatrix4fv(m_boneLocation[Index], 1, GL_TRUE, glm::value_ptr(Transform));
-        glUniformMatrix4fv(m_boneLocation[Index], 1, GL_TRUE, (const GLfloat*)Transform);
+    void SetBoneTransforms(const float *palette, int numBones){
+        if (skinningMode == SKINNING_DUAL_QUATERNION){
+            assert(numBones <= MAX_BONES_DQ);
+            glUniformMatrix2x4fv(m_bonesLocation, numBones, GL_FALSE, palette);
+        } else {
+            assert(numBones <= MAX_BONES);
+            glUniformMatrix3x4fv(m_bonesLocation, numBones, GL_FALSE, palette);
+        }
+        boneUploadCalls++;
     }
 
     void cleanPhysics(){
@@ -345,89 +1030,221 @@ private:
         delete physMesh;
     }
 
-    /**
-    *
-    */
-    void SetBoneTransform(int Index, const matrix4 *Transform){
-        Matrix4f tmpTransform;
-        tmpTransform.m[0][0] =  Transform->aa;
-        tmpTransform.m[0][1] =  Transform->ab;
-        tmpTransform.m[0][2] =  Transform->ac;
-        tmpTransform.m[0][3] =  Transform->ad;
-        tmpTransform.m[1][0] =  Transform->ba;
-        tmpTransform.m[1][1] =  Transform->bb;
-        tmpTransform.m[1][2] =  Transform->bc;
-        tmpTransform.m[1][3] =  Transform->bd;
-        tmpTransform.m[2][0] =  Transform->ca;
-        tmpTransform.m[2][1] =  Transform->cb;
-        tmpTransform.m[2][2] =  Transform->cc;
-        tmpTransform.m[2][3] =  Transform->cd;
-        tmpTransform.m[3][0] =  0;
-        tmpTransform.m[3][1] =  0;
-        tmpTransform.m[3][2] =  0;
-        tmpTransform.m[3][3] =  1;
-        SetBoneTransform(Index, tmpTransform);
-    }
-
     /**
     * Process to calculate all the transformation matrices for the object
     */
     void calcTransformationMatrices(){
-        float TimeInSeconds = 0.0f;
-        Matrix4f Identity;
-        Identity.InitIdentity();
-        const int nAnimations = mp_scene->mNumAnimations;
-
-        if (mp_scene != NULL && nAnimations > 0){
-            //Reserving space for all animations
-            bonesTransform = new matrix4*** [nAnimations];
+        const int nAnimations = getNumAnimations();
+
+        if (nAnimations > 0){
+            //Reserving space for all frames of all animations in only one buffer. There is
+            //one frame more at the end of the animation to interpolate the last frames
+            vector<int> framesPerAnim;
+            size_t framesFactorOne = 0;
+            for (int nAnim = 0; nAnim < nAnimations; nAnim++){
+                framesPerAnim.push_back(ceil(m_Clips[nAnim].getDuration() * getFpsModelFactor()) + 1);
+                framesFactorOne += ceil(m_Clips[nAnim].getDuration()) + 1;
+            }
             cout << "NumAnimations: " << nAnimations << endl;
 
             for (int nAnim = 0; nAnim < nAnimations; nAnim++){
 
-                const float TicksPerSecond = mp_scene->mAnimations[nAnim]->mTicksPerSecond > 0.0f ?
-                        mp_scene->mAnimations[nAnim]->mTicksPerSecond : 25.0f;
+                const float TicksPerSecond = m_Clips[nAnim].getTicksPerSecond() > 0.0f ?
+                        m_Clips[nAnim].getTicksPerSecond() : 25.0f;
 
                 cout << "TicksPerSecond: " << TicksPerSecond << endl;
-                cout << "Duration of the animation in ticks: " << mp_scene->mAnimations[nAnim]->mDuration << endl;
-                cout << "duration in s: " << mp_scene->mAnimations[nAnim]->mDuration / TicksPerSecond << " s" << endl;
+                cout << "Duration of the animation in ticks: " << m_Clips[nAnim].getDuration() << endl;
+                cout << "duration in s: " << m_Clips[nAnim].getDuration() / TicksPerSecond << " s" << endl;
                 cout << "Model FPS: " << getFpsModelFactor() * TicksPerSecond << endl;
 
-                const float endFrameTime = mp_scene->mAnimations[nAnim]->mDuration;
-                int nFrame = 0;
-                const int totalFrames = ceil(endFrameTime * getFpsModelFactor());
-                //Reserving space for all frames of the scene
-                bonesTransform[nAnim] = new matrix4** [totalFrames];
-
-                for (nFrame=0; nFrame < totalFrames; nFrame++){
-                    //Reading all the nodes
-                    ReadNodeHeirarchy(nFrame / getFpsModelFactor(), mp_scene->mRootNode, Identity);
-                    //Reserving space for all transformation matrices for each bone
-                    bonesTransform[nAnim][nFrame] = new matrix4* [m_NumBones];
-                    for (int BoneIndex=0; BoneIndex < m_NumBones; BoneIndex++){
-                        bonesTransform[nAnim][nFrame][BoneIndex] = new matrix4(m_BoneInfo[BoneIndex].FinalTransformation);
-                    }
-                }
-
-                cout << "Added: " << nFrame << " frames for " << mp_scene->mAnimations[nAnim]->mDuration / TicksPerSecond
+                cout << "Added: " << framesPerAnim[nAnim] << " frames for " << m_Clips[nAnim].getDuration() / TicksPerSecond
                 << " seconds for animation " << nAnim << endl;
             }
+
+            //Memory compared with baking every tick of the animations
+            const double bytesFactorOne = (double)framesFactorOne * m_NumBones * BAKED_MATRIX_FLOATS * sizeof(float);
+            size_t bytesAll = 0;
+            for (int nAnim = 0; nAnim < nAnimations; nAnim++){
+                bytesAll += (size_t)framesPerAnim[nAnim] * m_NumBones * BAKED_MATRIX_FLOATS * sizeof(float);
+            }
+            //With a factor above 1 there are more frames than ticks and nothing is saved
+            cout << "Baked poses: " << bytesAll / 1024 << " KB, with fpsModelFactor 1: " << bytesFactorOne / 1024 << " KB";
+            if (bytesFactorOne > bytesAll) cout << ". Saved: " << (bytesFactorOne - bytesAll) / 1024 << " KB";
+            cout << endl;
+
+            //The cache is next to the model and it's valid while the model file doesn't change
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            const string cachePath = modelPath + ".bakecache";
+            const uint64_t sourceHash = MappedFile::hashFile(modelPath);
+
+            if (sourceHash != 0 && bakedPoses.loadCache(cachePath, sourceHash, getFpsModelFactor(), m_NumBones, framesPerAnim)){
+                for (int nAnim = 0; nAnim < nAnimations; nAnim++){
+                    computeBakedBounds(nAnim);
+                }
+                cout << "Baked poses mapped from " << cachePath << ": " << bakedPoses.getSizeInBytes() / 1024 << " KB in "
+                     << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+            } else if (precalculateBonesTransform == BAKE_ALL){
+                bakedPoses.init(m_NumBones, framesPerAnim, true);
+                const double ms = bakeAllFrames(bakeThreads);
+                for (int nAnim = 0; nAnim < nAnimations; nAnim++){
+                    computeBakedBounds(nAnim);
+                    bakedPoses.setReady(nAnim);
+                }
+                cout << "Baked poses: " << bakedPoses.getSizeInBytes() / 1024 << " KB in " << ms << " ms" << endl;
+                if (sourceHash != 0 && bakedPoses.saveCache(cachePath, sourceHash, getFpsModelFactor())){
+                    cout << "Baked poses saved in " << cachePath << endl;
+                }
+            } else {
+                //Baking on demand, each animation is reserved when it is baked
+                bakedPoses.init(m_NumBones, framesPerAnim, false);
+                cout << "Each animation will be baked on its first use" << endl;
+            }
         } else {
             cout << "NumAnimations: 0" << endl;
         }
     }
 
+    /**
+    * Calculates all the frames of all the animations, spread over nThreads threads.
+    * Returns the time spent in milliseconds
+    */
+    double bakeAllFrames(int nThreads){
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        //List of frames to bake of all the animations reserved
+        vector<pair<int, int> > frames;
+        for (int nAnim = 0; nAnim < bakedPoses.getNumAnimations(); nAnim++){
+            if (bakedPoses.getPalette(nAnim, 0) == NULL) continue;
+            for (int nFrame = 0; nFrame < bakedPoses.getNumFrames(nAnim); nFrame++){
+                frames.push_back(make_pair(nAnim, nFrame));
+            }
+        }
+
+        //Frames are independent from each other, so we only need a scratch pose per chunk
+        const int chunk = 8;
+        if (nThreads == 1){
+            bakeFrames(frames, 0, frames.size());
+        } else if (nThreads <= 0){
+            ThreadPool::getDefault().parallelFor(frames.size(), chunk,
+                bind(&Model::bakeFrames, this, cref(frames), placeholders::_1, placeholders::_2));
+        } else {
+            ThreadPool pool(nThreads - 1);
+            pool.parallelFor(frames.size(), chunk,
+                bind(&Model::bakeFrames, this, cref(frames), placeholders::_1, placeholders::_2));
+        }
+
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+    * Bakes the animation if nobody has done it yet. In BAKE_LAZY it's done before
+    * returning, using the default pool. In BAKE_LAZY_ASYNC it's queued in the default pool
+    */
+    void bakeAnimation(int nAnim){
+        if (!bakedPoses.startBake(nAnim)) return;
+        bakedPoses.allocateAnimation(nAnim);
+
+        if (precalculateBonesTransform == BAKE_LAZY_ASYNC){
+            pendingBakes++;
+            ThreadPool::getDefault().run(bind(&Model::bakeAnimationTask, this, nAnim));
+        } else {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            vector<pair<int, int> > frames;
+            for (int nFrame = 0; nFrame < bakedPoses.getNumFrames(nAnim); nFrame++){
+                frames.push_back(make_pair(nAnim, nFrame));
+            }
+            ThreadPool::getDefault().parallelFor(frames.size(), 8,
+                bind(&Model::bakeFrames, this, cref(frames), placeholders::_1, placeholders::_2));
+            computeBakedBounds(nAnim);
+            bakedPoses.setReady(nAnim);
+            cout << "Baked animation " << nAnim << ": " << bakedPoses.getSizeInBytes(nAnim) / 1024 << " KB in "
+                 << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+        }
+    }
+
+    /**
+    * Bakes one animation in a worker of the pool
+    */
+    void bakeAnimationTask(int nAnim){
+        vector<pair<int, int> > frames;
+        for (int nFrame = 0; nFrame < bakedPoses.getNumFrames(nAnim); nFrame++){
+            frames.push_back(make_pair(nAnim, nFrame));
+        }
+        bakeFrames(frames, 0, frames.size());
+        computeBakedBounds(nAnim);
+        bakedPoses.setReady(nAnim);
+        pendingBakes--;
+    }
+
+    /**
+    * Buffer of the skinned vertices of all the meshes and the VAOs to draw them
+    */
+    void createSkinnedCache(SkinnedCache &cache){
+        cache.clear();
+        GLintptr offset = 0;
+        for(GLuint i = 0; i < this->meshes.size(); i++){
+            cache.offsets.push_back(offset);
+            offset += this->meshes[i]->getNumVertices() * SKINNED_VERTEX_FLOATS * sizeof(GLfloat);
+        }
+
+        glGenBuffers(1, &cache.buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, cache.buffer);
+        //Written and read only by the GPU
+        glBufferData(GL_ARRAY_BUFFER, offset, NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        cache.sizeInBytes = offset;
+
+        for(GLuint i = 0; i < this->meshes.size(); i++){
+            cache.vaos.push_back(this->meshes[i]->createSkinnedVAO(cache.buffer, cache.offsets[i]));
+        }
+        cout << "Skinning cache of " << directory << ": " << cache.sizeInBytes / 1024 << " KB" << endl;
+    }
+
+    /**
+    * Bounding boxes of the baked frames of the animation. They must be ready before the
+    * animation is marked as baked
+    */
+    void computeBakedBounds(int nAnim){
+        if (m_BoneBounds.size() == m_NumBones * BAKED_BOUNDS_FLOATS && m_NumBones > 0){
+            bakedPoses.computeBounds(nAnim, &m_BoneBounds[0]);
+        }
+    }
+
+    /**
+    * Bakes the frames [begin, end) of the list. It's safe to call it from several threads
+    */
+    void bakeFrames(const vector<pair<int, int> > &frames, int begin, int end){
+        if (m_NumBones == 0 || m_Skeleton.size() == 0) return;
+
+        vector<float> globals(m_Skeleton.size() * BAKED_MATRIX_FLOATS);
+        //Consecutive frames use consecutive keys
+        AnimationCursor cursor;
+
+        for (int i = begin; i < end; i++){
+            const int nAnim = frames[i].first;
+            const int nFrame = frames[i].second;
+            //Reading all the nodes. The last frame is the end of the animation
+            const float time = min(nFrame / getFpsModelFactor(), m_Clips[nAnim].getDuration());
+            evaluateSkeleton(time, nAnim, bakedPoses.getPalette(nAnim, nFrame), &globals[0], &cursor);
+        }
+    }
+
     /**
     *
     */
     void preprocessBones(Shader *shader){
-        for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(m_boneLocation) ; i++) {
-            char Name[128];
-            memset(Name, 0, sizeof(Name));
-            sprintf(Name, "gBones[%d]", i);
-            m_boneLocation[i] = glGetUniformLocation(shader->Program,Name);
-        }
+        m_bonesLocation = glGetUniformLocation(shader->Program, "gBones");
         m_animLoc = glGetUniformLocation(shader->Program, "nAnim");
+    }
+
+    /**
+    * Buffers of the animations evaluated at runtime, and the bake of the animations.
+    * There are no GL calls, the palettes are uploaded when they are drawn
+    */
+    void initBones(){
+        m_Palette.resize(m_NumBones * BAKED_MATRIX_FLOATS);
+        poseCache.init(m_NumBones);
+        m_NodeGlobals.resize(m_Skeleton.size() * BAKED_MATRIX_FLOATS);
 
         if (precalculateBonesTransform){
             calcTransformationMatrices();
@@ -438,7 +1255,7 @@ private:
     * Functions
     */
     // Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string path, Shader *shader)
+    bool loadModel(string path)
     {
         m_NumBones = 0;
         m_BoneMapping.clear();
@@ -472,56 +1289,273 @@ private:
                                              // collapsed and joined.
         0;
 
+        // Retrieve the directory path of the filepath
+        this->directory = path.substr(0, path.find_last_of('/'));
+        this->modelPath = path;
+
+        //The cache is next to the model and it's valid while the model file doesn't change
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        const string cachePath = path + ".meshcache";
+        const uint64_t sourceHash = MappedFile::hashFile(path);
+        if (sourceHash != 0 && loadMeshCache(cachePath, sourceHash)){
+            cout << "Model read from " << cachePath << " in "
+                 << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+            return true;
+        }
+
+        if (importer == NULL){
+            importer = new Assimp::Importer();
+        }
         mp_scene = importer->ReadFile(path, ppsteps);
         // Check for errors
         if(!mp_scene || mp_scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !mp_scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer->GetErrorString() << endl;
-            return;
+            cleanScene();
+            return false;
         }
 //        Assimp::Exporter *exporter = new Assimp::Exporter();
 //        const aiExportFormatDesc* exportFormatDesc = exporter->GetExportFormatDescription(0);
 //        exporter->Export(mp_scene, exportFormatDesc->id, "C:/asd/exportado.obj");
 //        delete exporter;
         InitFromScene(mp_scene, path);
-        // Retrieve the directory path of the filepath
-        this->directory = path.substr(0, path.find_last_of('/'));
+        initClips();
         cout << "There are " << mp_scene->mNumMeshes << " meshes" << endl;
         // Process ASSIMP's root node recursively
-        this->processNode(mp_scene->mRootNode, mp_scene, shader);
+        this->processNode(mp_scene->mRootNode, mp_scene);
+        //The bones are known after processing the meshes
+        vector<SceneNode> nodes;
+        flattenNodes(mp_scene->mRootNode, -1, nodes);
+        initSkeleton(nodes);
+        //Everything needed at runtime has been copied from the scene
+        cleanScene();
+        cout << "Model loaded with assimp in "
+             << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+
+        if (sourceHash != 0 && saveMeshCache(cachePath, sourceHash, nodes)){
+            cout << "Model saved in " << cachePath << endl;
+        }
+        return true;
+    }
+
+    /**
+    * Creates the meshes read by loadModel and loads their textures
+    */
+    void uploadMeshes(Shader *shader){
+        for (size_t i = 0; i < pendingMeshes.size(); i++){
+            PendingMesh &pending = pendingMeshes[i];
+            vector<Texture> textures;
+            for (size_t j = 0; j < pending.textures.size(); j++){
+                textures.push_back(loadModelTexture(pending.textures[j].second, pending.textures[j].first));
+            }
+            //The mesh takes the vectors without copying them
+            this->meshes.push_back(new Mesh(move(pending.vertices), move(pending.indices), move(textures), move(pending.bones), shader));
+        }
+        //Swapping with an empty vector frees the memory, clear doesn't
+        vector<PendingMesh>().swap(pendingMeshes);
         cout << "Meshes creados " << this->meshes.size() << endl;
     }
 
+    /**
+    * Writes everything the model keeps from the scene: the streams and textures of the
+    * meshes read by loadModel, the bones, the node hierarchy and the clips
+    */
+    bool saveMeshCache(const string &path, uint64_t sourceHash, const vector<SceneNode> &nodes){
+        CacheWriter writer;
+        writer.write(m_GlobalInverseTransform);
+
+        //The bones by index, with the names that were in m_BoneMapping
+        vector<string> boneNames(m_NumBones);
+        for (map<string, uint32_t>::const_iterator it = m_BoneMapping.begin(); it != m_BoneMapping.end(); it++){
+            boneNames[it->second] = it->first;
+        }
+        writer.write(m_NumBones);
+        for (uint32_t i = 0; i < m_NumBones; i++){
+            writer.writeString(boneNames[i]);
+            writer.write(m_BoneInfo[i].BoneOffset);
+        }
+        writer.writeArray(m_BoneBounds);
+
+        writer.write((uint32_t)nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++){
+            writer.writeString(nodes[i].name);
+            writer.write(nodes[i].parent);
+            writer.write(nodes[i].transform);
+        }
+
+        writer.write((uint32_t)m_Clips.size());
+        for (size_t i = 0; i < m_Clips.size(); i++){
+            m_Clips[i].write(writer);
+        }
+
+        writer.write((uint32_t)pendingMeshes.size());
+        for (size_t i = 0; i < pendingMeshes.size(); i++){
+            const PendingMesh &mesh = pendingMeshes[i];
+            writer.write((uint32_t)mesh.textures.size());
+            for (size_t j = 0; j < mesh.textures.size(); j++){
+                writer.write(mesh.textures[j].first);
+                writer.writeString(mesh.textures[j].second.C_Str());
+            }
+            writer.writeArray(mesh.vertices);
+            writer.writeArray(mesh.indices);
+            writer.writeArray(mesh.bones);
+        }
+        const vector<char> &data = writer.getData();
+
+        MeshCacheHeader header;
+        fillMeshCacheHeader(header, sourceHash);
+        header.dataSize = data.size();
+        header.dataHash = MappedFile::hash(data.empty() ? NULL : &data[0], data.size());
+
+        ofstream file(path.c_str(), ios::out | ios::binary | ios::trunc);
+        if (!file.is_open()) return false;
+        file.write((const char *)&header, sizeof(header));
+        const char padding[CACHE_STREAM_ALIGN] = {0};
+        file.write(padding, header.dataOffset - sizeof(header));
+        file.write(data.empty() ? NULL : &data[0], data.size());
+        return file.good();
+    }
+
+    /**
+    * Reads the model from a mesh cache without running assimp. The file is mapped and the
+    * streams of the meshes are copied from the mapping to the pending meshes. Returns
+    * false, without changing the model, if the file doesn't exist, is corrupted or was
+    * made from another model
+    */
+    bool loadMeshCache(const string &path, uint64_t sourceHash){
+        MappedFile file;
+        if (!file.open(path) || file.getSize() < sizeof(MeshCacheHeader)) return false;
+
+        MeshCacheHeader expected;
+        fillMeshCacheHeader(expected, sourceHash);
+        const char *bytes = (const char *)file.getData();
+        const MeshCacheHeader *header = (const MeshCacheHeader *)bytes;
+        if (memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0
+            || header->version != expected.version || header->sourceHash != expected.sourceHash
+            || header->vertexSize != expected.vertexSize || header->boneDataSize != expected.boneDataSize
+            || header->dataOffset != expected.dataOffset
+            || file.getSize() != header->dataOffset + header->dataSize
+            || MappedFile::hash(bytes + header->dataOffset, header->dataSize) != header->dataHash){
+            return false;
+        }
+        CacheReader reader(bytes + header->dataOffset, header->dataSize);
+
+        Matrix4f globalInverse;
+        reader.read(globalInverse);
+
+        uint32_t numBones = 0;
+        reader.read(numBones);
+        map<string, uint32_t> boneMapping;
+        vector<BoneInfo> boneInfo;
+        for (uint32_t i = 0; reader.isValid() && i < numBones; i++){
+            string name;
+            reader.readString(name);
+            boneMapping[name] = i;
+            boneInfo.push_back(BoneInfo());
+            reader.read(boneInfo.back().BoneOffset);
+        }
+        vector<float> boneBounds;
+        reader.readArray(boneBounds);
+
+        uint32_t numNodes = 0;
+        reader.read(numNodes);
+        vector<SceneNode> nodes;
+        for (uint32_t i = 0; reader.isValid() && i < numNodes; i++){
+            nodes.push_back(SceneNode());
+            reader.readString(nodes.back().name);
+            reader.read(nodes.back().parent);
+            reader.read(nodes.back().transform);
+        }
+
+        uint32_t numClips = 0;
+        reader.read(numClips);
+        vector<AnimationClip> clips;
+        for (uint32_t i = 0; reader.isValid() && i < numClips; i++){
+            clips.push_back(AnimationClip());
+            clips.back().read(reader);
+        }
+
+        uint32_t numMeshes = 0;
+        reader.read(numMeshes);
+        vector<PendingMesh> cached;
+        for (uint32_t i = 0; reader.isValid() && i < numMeshes; i++){
+            cached.push_back(PendingMesh());
+            PendingMesh &mesh = cached.back();
+            uint32_t numTextures = 0;
+            reader.read(numTextures);
+            for (uint32_t j = 0; reader.isValid() && j < numTextures; j++){
+                string texturePath;
+                mesh.textures.push_back(pair<GLuint, aiString>());
+                reader.read(mesh.textures.back().first);
+                reader.readString(texturePath);
+                mesh.textures.back().second = aiString(texturePath);
+            }
+            reader.readArray(mesh.vertices);
+            reader.readArray(mesh.indices);
+            reader.readArray(mesh.bones);
+            if (!mesh.bones.empty() && mesh.bones.size() != mesh.vertices.size()) return false;
+        }
+        if (!reader.isValid() || boneBounds.size() != numBones * BAKED_BOUNDS_FLOATS) return false;
+
+        m_GlobalInverseTransform = globalInverse;
+        m_NumBones = numBones;
+        m_BoneMapping.swap(boneMapping);
+        m_BoneInfo.swap(boneInfo);
+        m_BoneBounds.swap(boneBounds);
+        m_Clips.swap(clips);
+        pendingMeshes.swap(cached);
+        initSkeleton(nodes);
+        cout << "Mesh cache: " << pendingMeshes.size() << " meshes, " << m_NumBones << " bones, " << nodes.size()
+             << " nodes, " << m_Clips.size() << " clips, " << file.getSize() / 1024 << " KB" << endl;
+        return true;
+    }
+
+    /**
+    *
+    */
+    void fillMeshCacheHeader(MeshCacheHeader &header, uint64_t sourceHash){
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "MSHC", 4);
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.vertexSize = sizeof(Vertex);
+        header.boneDataSize = sizeof(PackedBoneData);
+        header.dataOffset = (sizeof(MeshCacheHeader) + CACHE_STREAM_ALIGN - 1) & ~(CACHE_STREAM_ALIGN - 1);
+    }
+
     /**
     * Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
     */
-    void processNode(aiNode* node, const aiScene* scene, Shader *shader){
+    void processNode(aiNode* node, const aiScene* scene){
         // Process each mesh located at the current node
         for(GLuint i = 0; i < node->mNumMeshes; i++)
         {
             // The node object only contains indices to index the actual objects in the scene.
             // The scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            this->meshes.push_back(this->processMesh(i, mesh, scene, shader));
+            this->pendingMeshes.push_back(PendingMesh());
+            this->processMesh(node->mMeshes[i], mesh, scene, this->pendingMeshes.back());
         }
         // After we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(GLuint i = 0; i < node->mNumChildren; i++){
-            this->processNode(node->mChildren[i], scene, shader);
+            this->processNode(node->mChildren[i], scene);
         }
     }
 
     /**
-    *
+    * Copies the data of the mesh to pending, without GL calls. The textures are only
+    * referenced, they are loaded when the mesh is uploaded. idMesh is the index of the
+    * mesh in the scene
     */
-    Mesh * processMesh(GLuint idMesh, aiMesh* mesh, const aiScene* scene, Shader *shader){
-        // Data to fill
-        vector<Vertex> vertices;
-        vector<GLuint> indices;
-        vector<Texture> textures;
+    void processMesh(GLuint idMesh, aiMesh* mesh, const aiScene* scene, PendingMesh &pending){
+        // Data to fill, sized once and written in place
+        vector<Vertex> &vertices = pending.vertices;
+        vector<GLuint> &indices = pending.indices;
+        vertices.resize(mesh->mNumVertices);
 
         // Walk through each of the mesh's vertices
         for(GLuint i = 0; i < mesh->mNumVertices; i++){
-            Vertex vertex;
+            Vertex &vertex = vertices[i];
             glm::vec3 vectorV; // We declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // Positions
             vectorV.x = mesh->mVertices[i].x;
@@ -566,15 +1600,20 @@ private:
             }
             else
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-            vertices.push_back(vertex);
         }
+        // The faces are triangles after aiProcess_Triangulate, but points and lines can remain
+        size_t numIndices = 0;
+        for(GLuint i = 0; i < mesh->mNumFaces; i++)
+            numIndices += mesh->mFaces[i].mNumIndices;
+        indices.resize(numIndices);
         // Now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+        GLuint *index = indices.empty() ? NULL : &indices[0];
         for(GLuint i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace &face = mesh->mFaces[i];
             // Retrieve all indices of the face and store them in the indices vector
-            for(GLuint j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
+            memcpy(index, face.mIndices, face.mNumIndices * sizeof(GLuint));
+            index += face.mNumIndices;
         }
         // Process materials
 
@@ -590,38 +1629,31 @@ private:
 
             testTextures(material);
             // 1. Diffuse maps
-            vector<Texture> diffuseMaps = this->loadMaterialTextures(material, aiTextureType_DIFFUSE);
-            textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+            this->getMaterialTextures(material, aiTextureType_DIFFUSE, pending.textures);
             // 2. Specular maps
-            vector<Texture> specularMaps = this->loadMaterialTextures(material, aiTextureType_SPECULAR);
-            textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+            this->getMaterialTextures(material, aiTextureType_SPECULAR, pending.textures);
             // 3. Opacity maps
-            vector<Texture> opacityMaps = this->loadMaterialTextures(material, aiTextureType_OPACITY);
-            textures.insert(textures.end(), opacityMaps.begin(), opacityMaps.end());
+            this->getMaterialTextures(material, aiTextureType_OPACITY, pending.textures);
             // 4. normalMaps
-            vector<Texture> normalMaps = this->loadMaterialTextures(material, aiTextureType_HEIGHT);
-            textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+            this->getMaterialTextures(material, aiTextureType_HEIGHT, pending.textures);
 
             //cout << "opacityMaps size: " << opacityMaps.size() << endl;
         }
 
-        vector<VertexBoneData> Bones;
-        processBones(idMesh, scene, Bones);
-        // Return a mesh object created from the extracted mesh data
-        return new Mesh(&vertices, &indices, &textures, &Bones, shader);;
+        processBones(idMesh, mesh, pending.bones);
     }
 
     /**
-    *
+    * The weights are added in floats and packed at the end, keeping the NUM_BONES_PER_VERTEX
+    * largest of each vertex. idMesh is the index of the mesh in the scene
     */
-    void processBones(int idMesh, const aiScene* scene, vector<VertexBoneData> &Bones){
+    void processBones(int idMesh, aiMesh* mesh, vector<PackedBoneData> &Bones){
         // Count the number of vertices and indices
-        GLuint NumVertices = 0;
-        NumVertices = scene->mMeshes[idMesh]->mNumVertices;
-        aiMesh* mesh = scene->mMeshes[idMesh];
+        GLuint NumVertices = mesh->mNumVertices;
 
         if (mesh->mNumBones > 0){
-            Bones.resize(NumVertices);
+            vector<VertexBoneData> weights(NumVertices);
+            uint32_t dropped = 0;
 //            cout << "mesh " << idMesh << " tiene " << mesh->mNumBones << " bones" <<endl;
             for(GLuint j = 0; j < mesh->mNumBones; j++){
                 uint32_t BoneIndex = 0;
@@ -635,6 +1667,8 @@ private:
                     m_BoneInfo.push_back(bi);
                     m_BoneInfo[BoneIndex].BoneOffset = mesh->mBones[j]->mOffsetMatrix;
                     m_BoneMapping[BoneName] = BoneIndex;
+                    m_BoneBounds.resize(m_NumBones * BAKED_BOUNDS_FLOATS);
+                    BakedPoses::resetBounds(&m_BoneBounds[BoneIndex * BAKED_BOUNDS_FLOATS]);
                     //cout << "BoneName: " << BoneName << endl;
                 } else {
                     BoneIndex = m_BoneMapping[BoneName];
@@ -644,9 +1678,24 @@ private:
                 for (uint32_t k = 0 ; k < mesh->mBones[j]->mNumWeights ; k++) {
                     uint32_t VertexID = mesh->mBones[j]->mWeights[k].mVertexId;
                     float Weight  = mesh->mBones[j]->mWeights[k].mWeight;
-                    Bones[VertexID].AddBoneData(BoneIndex, Weight);
+                    if (!weights[VertexID].AddBoneData(BoneIndex, Weight))
+                        dropped++;
+                    if (Weight > 0){
+                        const aiVector3D &v = mesh->mVertices[VertexID];
+                        const float point[BAKED_BOUNDS_FLOATS] = {v.x, v.y, v.z, v.x, v.y, v.z};
+                        BakedPoses::mergeBounds(&m_BoneBounds[BoneIndex * BAKED_BOUNDS_FLOATS], point);
+                    }
                 }
             }
+
+            if (dropped > 0){
+                cout << "Mesh " << idMesh << ": " << dropped << " bone weights dropped from vertices with more than "
+                     << NUM_BONES_PER_VERTEX << " bones" << endl;
+            }
+            Bones.resize(NumVertices);
+            for (GLuint i = 0; i < NumVertices; i++){
+                Bones[i].Pack(weights[i]);
+            }
         }
     }
 
@@ -669,12 +1718,11 @@ private:
 
 
     /**
-    * Checks all material textures of a given type and loads the textures if they're not loaded yet.
-    * The required info is returned as a Texture struct.
+    * Adds the type and path of all the material textures of a given type. They are loaded
+    * by loadModelTexture when the mesh is uploaded
     */
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type)
+    void getMaterialTextures(aiMaterial* mat, aiTextureType type, vector<pair<GLuint, aiString> > &textures)
     {
-        vector<Texture> textures;
         for(GLuint i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
@@ -713,30 +1761,35 @@ private:
 //            cout << " trans: " << colorTrans.r << "," << colorTrans.g << "," << colorTrans.b << endl;
 
 
-            // Check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            GLboolean skip = false;
-            for(GLuint j = 0; j < textures_loaded.size(); j++){
-                if(textures_loaded[j].path == str){
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // A texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
+            textures.push_back(make_pair((GLuint)type, str));
+//            cout << endl;
+        }
+    }
 
-            if(!skip)
-            {   // If texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory, true);
-                texture.type = type;
-                texture.path = str;
-                textures.push_back(texture);
-                this->textures_loaded.push_back(texture);  // Store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-//                cout << " LOADED!!";
-            }
+    /**
+    * Returns the texture of the path from the TextureCache, so the textures used by several
+    * meshes or models are only loaded once
+    */
+    Texture loadModelTexture(const aiString &path, GLuint type){
+        Texture texture;
+        texture.id = TextureCache::getDefault().acquire(this->directory + '/' + path.C_Str(),
+                         TEXTURE_CACHE_ALPHA | TEXTURE_CACHE_MODEL, bind(&Model::createModelTexture, this, path, type));
+        texture.type = type;
+        texture.path = path;
+        this->textures_loaded.push_back(texture);  // Released when the model is deleted
+        return texture;
+    }
 
-//            cout << endl;
+    /**
+    * Loads a texture that isn't in the cache. With the default TextureStreamer enabled, the
+    * texture has a placeholder until the file is decoded
+    */
+    GLuint createModelTexture(const aiString &path, GLuint type){
+        TextureStreamer &streamer = TextureStreamer::getDefault();
+        if (streamer.isEnabled() && TextureStreamer::canStream(path.C_Str())){
+            return streamer.request(path.C_Str(), this->directory, true, type == aiTextureType_HEIGHT);
         }
-        return textures;
+        return TextureFromFile(path.C_Str(), this->directory, true);
     }
 
     /**
@@ -747,188 +1800,216 @@ private:
 //        m_GlobalInverseTransform = glm::inverse(aiMatrix4x4ToGlm(&pScene->mRootNode->mTransformation));
         m_GlobalInverseTransform = pScene->mRootNode->mTransformation;
         m_GlobalInverseTransform.Inverse();
-        return GLCheckError();
+        //It runs in loadData, without GL context. The GL errors are checked in finalize
+        return true;
     }
 
 
     /**
-    *
+    * Converts the animations of the scene to compact clips, printing their sizes and
+    * the max error of the conversion
     */
-    const aiNodeAnim* FindNodeAnim(const aiAnimation* pAnimation, const string NodeName){
-        for (uint32_t i = 0 ; i < pAnimation->mNumChannels ; i++) {
-            const aiNodeAnim* pNodeAnim = pAnimation->mChannels[i];
-
-            if (string(pNodeAnim->mNodeName.data) == NodeName) {
-                return pNodeAnim;
-            }
+    void initClips(){
+        m_Clips.clear();
+        m_Clips.resize(mp_scene->mNumAnimations);
+        for (uint32_t nAnim = 0; nAnim < mp_scene->mNumAnimations; nAnim++){
+            const ClipBuildReport report = m_Clips[nAnim].build(mp_scene->mAnimations[nAnim]);
+            cout << "Clip " << nAnim << ": " << report.sourceBytes / 1024.0 << " KB, " << report.sourceKeys << " keys -> "
+                 << m_Clips[nAnim].getSizeInBytes() / 1024.0 << " KB, " << m_Clips[nAnim].getNumKeys() << " keys. Max error: "
+                 << report.positionError << " position, " << report.rotationError << " degrees, "
+                 << report.scalingError << " scaling" << endl;
         }
-        return NULL;
     }
 
     /**
-    *
+    * Builds the skeleton from the nodes flattened with the parents before their children,
+    * resolving the bone and the channel of every animation for each node
     */
-    uint32_t FindScaling(float AnimationTime, const aiNodeAnim* pNodeAnim){
-        assert(pNodeAnim->mNumScalingKeys > 0);
-        for (uint32_t i = 0 ; i < pNodeAnim->mNumScalingKeys - 1 ; i++) {
-            if (AnimationTime < (float)pNodeAnim->mScalingKeys[i + 1].mTime) {
-                return i;
+    void initSkeleton(const vector<SceneNode> &nodes){
+        m_Skeleton.clear();
+        m_NodeChannels.clear();
+        if (nodes.empty()) return;
+
+        m_BoneNodes.assign(m_NumBones, -1);
+        for (size_t i = 0; i < nodes.size(); i++){
+            SkeletonNode node;
+            node.parent = nodes[i].parent;
+            node.bone = -1;
+            node.lodSkip = false;
+            BakedPoses::store(nodes[i].transform, node.localTransform);
+            map<string, uint32_t>::const_iterator itBone = m_BoneMapping.find(nodes[i].name);
+            if (itBone != m_BoneMapping.end()) {
+                node.bone = itBone->second;
+                m_BoneNodes[node.bone] = i;
             }
+            m_Skeleton.push_back(node);
         }
-//        assert(0);
-        return 0;
-    }
 
-    /**
-    *
-    */
-    void CalcInterpolatedScaling(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim)
-    {
-        if (pNodeAnim->mNumScalingKeys == 1) {
-            Out = pNodeAnim->mScalingKeys[0].mValue;
-            return;
+        //The packed transforms used by evaluateSkeleton
+        BakedPoses::store(m_GlobalInverseTransform, m_GlobalInverse);
+        m_BoneOffsets.resize(m_NumBones * BAKED_MATRIX_FLOATS);
+        for (uint32_t i = 0; i < m_NumBones; i++){
+            BakedPoses::store(m_BoneInfo[i].BoneOffset, &m_BoneOffsets[i * BAKED_MATRIX_FLOATS]);
         }
 
-        uint32_t ScalingIndex = FindScaling(AnimationTime, pNodeAnim);
-        uint32_t NextScalingIndex = (ScalingIndex + 1);
-        assert(NextScalingIndex < pNodeAnim->mNumScalingKeys);
-        float DeltaTime = (float)(pNodeAnim->mScalingKeys[NextScalingIndex].mTime - pNodeAnim->mScalingKeys[ScalingIndex].mTime);
+        m_NodeChannels.resize(m_Clips.size());
+        for (uint32_t nAnim = 0; nAnim < m_Clips.size(); nAnim++){
+            m_NodeChannels[nAnim].resize(nodes.size());
+            for (size_t i = 0; i < nodes.size(); i++){
+                m_NodeChannels[nAnim][i] = m_Clips[nAnim].findChannel(nodes[i].name);
+            }
+        }
 
-        float preFactor = AnimationTime - (float)pNodeAnim->mScalingKeys[ScalingIndex].mTime;
-        if (preFactor < 0.0f) preFactor = 0.0f;
-        float Factor = preFactor / DeltaTime;
-//        assert(Factor >= 0.0f && Factor <= 1.0f);
-        const aiVector3D& Start = pNodeAnim->mScalingKeys[ScalingIndex].mValue;
-        const aiVector3D& End   = pNodeAnim->mScalingKeys[NextScalingIndex].mValue;
-        aiVector3D Delta = End - Start;
-        Out = Start + Factor * Delta;
+        initLodBones(nodes);
     }
 
     /**
-    *
+    * Finds the detail bones, and their descendants, to skip in the reduced skeleton. Each
+    * one is moved with the nearest bone above it that is evaluated
     */
-    uint32_t FindRotation(float AnimationTime, const aiNodeAnim* pNodeAnim)
-    {
-        assert(pNodeAnim->mNumRotationKeys > 0);
-
-        for (uint32_t i = 0 ; i < pNodeAnim->mNumRotationKeys - 1 ; i++) {
-            if (AnimationTime < (float)pNodeAnim->mRotationKeys[i + 1].mTime) {
-                return i;
+    void initLodBones(const vector<SceneNode> &nodes){
+        static const char *detailNames[] = {"finger", "thumb", "index", "pinky", "toe", "face", "eye",
+                                            "brow", "jaw", "lip", "mouth", "tongue", "teeth", "cheek", "nose"};
+        m_LodBoneRemap.assign(m_NumBones, -1);
+        m_NumLodBones = m_NumBones;
+        //Whether each node is a detail node, and the nearest bone evaluated above or in it
+        vector<bool> detail(nodes.size(), false);
+        vector<int> keptBone(nodes.size(), -1);
+
+        for (size_t i = 0; i < nodes.size(); i++){
+            SkeletonNode &node = m_Skeleton[i];
+            string name(nodes[i].name);
+            transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+            detail[i] = node.parent >= 0 && detail[node.parent];
+            for (size_t j = 0; !detail[i] && j < ARRAY_SIZE_IN_ELEMENTS(detailNames); j++){
+                detail[i] = name.find(detailNames[j]) != string::npos;
+            }
+            const int ancestorBone = node.parent >= 0 ? keptBone[node.parent] : -1;
+            node.lodSkip = detail[i] && ancestorBone >= 0;
+
+            if (node.lodSkip){
+                keptBone[i] = ancestorBone;
+                if (node.bone >= 0 && m_LodBoneRemap[node.bone] < 0){
+                    m_LodBoneRemap[node.bone] = ancestorBone;
+                    m_NumLodBones--;
+                }
+            } else {
+                keptBone[i] = node.bone >= 0 ? node.bone : ancestorBone;
             }
         }
-
-//        assert(0);
-
-        return 0;
+        cout << "Reduced skeleton: " << m_NumLodBones << " of " << m_NumBones << " bones" << endl;
     }
 
     /**
-    *
+    * Adds the node and all its descendants to the list, with the parents first
     */
-    void CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTime, const aiNodeAnim* pNodeAnim)
-    {
-        // we need at least two values to interpolate...
-        if (pNodeAnim->mNumRotationKeys == 1) {
-            Out = pNodeAnim->mRotationKeys[0].mValue;
-            return;
-        }
-
-        uint32_t RotationIndex = FindRotation(AnimationTime, pNodeAnim);
-        uint32_t NextRotationIndex = (RotationIndex + 1);
-        assert(NextRotationIndex < pNodeAnim->mNumRotationKeys);
-        float DeltaTime = (float)(pNodeAnim->mRotationKeys[NextRotationIndex].mTime - pNodeAnim->mRotationKeys[RotationIndex].mTime);
+    void flattenNodes(const aiNode* pNode, int parent, vector<SceneNode> &nodes){
+        SceneNode node;
+        node.name = pNode->mName.data;
+        node.parent = parent;
+        node.transform = Matrix4f(pNode->mTransformation);
+        const int index = nodes.size();
+        nodes.push_back(node);
 
-        float preFactor = AnimationTime - (float)pNodeAnim->mRotationKeys[RotationIndex].mTime;
-        if (preFactor < 0.0f) preFactor = 0.0f;
-
-        float Factor = preFactor / DeltaTime;
-//        assert(Factor >= 0.0f && Factor <= 1.0f);
-        const aiQuaternion& StartRotationQ = pNodeAnim->mRotationKeys[RotationIndex].mValue;
-        const aiQuaternion& EndRotationQ   = pNodeAnim->mRotationKeys[NextRotationIndex].mValue;
-        aiQuaternion::Interpolate(Out, StartRotationQ, EndRotationQ, Factor);
-        Out = Out.Normalize();
+        for (uint32_t i = 0 ; i < pNode->mNumChildren ; i++) {
+            flattenNodes(pNode->mChildren[i], index, nodes);
+        }
     }
 
     /**
-    *
+    * Interpolates the transformation of an animated node
     */
-    uint32_t FindPosition(float AnimationTime, const aiNodeAnim* pNodeAnim)
-    {
-        for (uint32_t i = 0 ; i < pNodeAnim->mNumPositionKeys - 1 ; i++) {
-            if (AnimationTime < (float)pNodeAnim->mPositionKeys[i + 1].mTime) {
-                return i;
-            }
-        }
-//        assert(0);
-        return 0;
+    void CalcNodeTransform(Matrix4f &Out, float AnimationTime, const AnimationClip &clip, int nChannel, uint32_t *cursor){
+        float t[3], q[4], s[3];
+        clip.sampleChannel(nChannel, AnimationTime, cursor, t, q, s);
+
+        Matrix4f ScalingM;
+        ScalingM.InitScaleTransform(s[0], s[1], s[2]);
+        Matrix4f RotationM = Matrix4f(aiQuaternion(q[0], q[1], q[2], q[3]).GetMatrix());
+        Matrix4f TranslationM;
+        TranslationM.InitTranslationTransform(t[0], t[1], t[2]);
+
+        // Combine the above transformations
+        Out = TranslationM * RotationM * ScalingM;
     }
 
     /**
-    *
+    * Calculates the packed transformation of every bone for the time of the animation
+    * nAnim. globals is scratch space for BAKED_MATRIX_FLOATS floats per skeleton node.
+    * cursor (optional) remembers the keys used in the last call of the same instance
     */
-    void CalcInterpolatedPosition(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim)
-    {
-        if (pNodeAnim->mNumPositionKeys == 1) {
-            Out = pNodeAnim->mPositionKeys[0].mValue;
-            return;
-        }
+    void evaluateSkeleton(float AnimationTime, int nAnim, float *palette, float *globals,
+                          AnimationCursor *cursor = NULL, bool reducedBones = false){
+        const AnimationClip &clip = m_Clips[nAnim];
+        const int *channels = &m_NodeChannels[nAnim][0];
+        float NodeTransformation[BAKED_MATRIX_FLOATS];
+
+        //Parents are always before their children, so their global transform is ready.
+        //The global inverse transform goes in the root, so it's only multiplied once
+        for (size_t i = 0; i < m_Skeleton.size(); i++){
+            const SkeletonNode &node = m_Skeleton[i];
+            if (reducedBones && node.lodSkip) continue;
+            const int nChannel = channels[i];
+            const float *local = node.localTransform;
+
+            if (nChannel >= 0) {
+                uint32_t *lastKeys = cursor != NULL ? cursor->getChannel(nAnim, nChannel, clip.getNumChannels()) : NULL;
+                clip.sampleChannelAffine(nChannel, AnimationTime, lastKeys, NodeTransformation);
+                local = NodeTransformation;
+            }
 
-        uint32_t PositionIndex = FindPosition(AnimationTime, pNodeAnim);
-        uint32_t NextPositionIndex = (PositionIndex + 1);
-        assert(NextPositionIndex < pNodeAnim->mNumPositionKeys);
-        float DeltaTime = (float)(pNodeAnim->mPositionKeys[NextPositionIndex].mTime - pNodeAnim->mPositionKeys[PositionIndex].mTime);
+            const float *parent = node.parent >= 0 ? globals + node.parent * BAKED_MATRIX_FLOATS : m_GlobalInverse;
+            affineMul(parent, local, globals + i * BAKED_MATRIX_FLOATS);
+        }
 
-        float preFactor = AnimationTime - (float)pNodeAnim->mPositionKeys[PositionIndex].mTime;
-        if (preFactor < 0.0f) preFactor = 0.0f;
+        //All the bones at once, with their offsets one after the other
+        const float *offsets = &m_BoneOffsets[0];
+        for (uint32_t bone = 0; bone < m_NumBones; bone++){
+            const int nNode = m_BoneNodes[bone];
+            if (nNode >= 0 && !(reducedBones && m_LodBoneRemap[bone] >= 0)){
+                affineMul(globals + nNode * BAKED_MATRIX_FLOATS, offsets + bone * BAKED_MATRIX_FLOATS,
+                          palette + bone * BAKED_MATRIX_FLOATS);
+            }
+        }
 
-        float Factor = preFactor / DeltaTime;
-//        assert(Factor >= 0.0f && Factor <= 1.0f);
-        const aiVector3D& Start = pNodeAnim->mPositionKeys[PositionIndex].mValue;
-        const aiVector3D& End = pNodeAnim->mPositionKeys[NextPositionIndex].mValue;
-        aiVector3D Delta = End - Start;
-        Out = Start + Factor * Delta;
+        //The skipped bones follow the nearest bone evaluated
+        if (reducedBones){
+            for (uint32_t bone = 0; bone < m_NumBones; bone++){
+                if (m_LodBoneRemap[bone] >= 0){
+                    memcpy(palette + bone * BAKED_MATRIX_FLOATS, palette + m_LodBoneRemap[bone] * BAKED_MATRIX_FLOATS,
+                           BAKED_MATRIX_FLOATS * sizeof(float));
+                }
+            }
+        }
     }
 
     /**
-    *
+    * The original evaluation with full Matrix4f products. Only kept to compare with
+    * evaluateSkeleton. globals is scratch space for one matrix per skeleton node
     */
-    void ReadNodeHeirarchy(float AnimationTime, const aiNode* pNode, const Matrix4f& ParentTransform){
-        string NodeName(pNode->mName.data);
-        const aiAnimation* pAnimation = mp_scene->mAnimations[0];
-        Matrix4f NodeTransformation(pNode->mTransformation);
-        const aiNodeAnim* pNodeAnim = FindNodeAnim(pAnimation, NodeName);
-
-        if (pNodeAnim) {
-            // Interpolate scaling and generate scaling transformation matrix
-            aiVector3D Scaling;
-            CalcInterpolatedScaling(Scaling, AnimationTime, pNodeAnim);
-            Matrix4f ScalingM;
-            ScalingM.InitScaleTransform(Scaling.x, Scaling.y, Scaling.z);
-
-            // Interpolate rotation and generate rotation transformation matrix
-            aiQuaternion RotationQ;
-            CalcInterpolatedRotation(RotationQ, AnimationTime, pNodeAnim);
-            Matrix4f RotationM = Matrix4f(RotationQ.GetMatrix());
+    void evaluateSkeletonReference(float AnimationTime, int nAnim, Matrix4f *pose, Matrix4f *globals){
+        Matrix4f NodeTransformation;
 
-            // Interpolate translation and generate translation transformation matrix
-            aiVector3D Translation;
-            CalcInterpolatedPosition(Translation, AnimationTime, pNodeAnim);
-            Matrix4f TranslationM;
-            TranslationM.InitTranslationTransform(Translation.x, Translation.y, Translation.z);
+        for (size_t i = 0; i < m_Skeleton.size(); i++){
+            const SkeletonNode &node = m_Skeleton[i];
+            const int nChannel = m_NodeChannels[nAnim][i];
 
-            // Combine the above transformations
-            NodeTransformation = TranslationM * RotationM * ScalingM;
-        }
-
-        Matrix4f GlobalTransformation = ParentTransform * NodeTransformation;
+            if (nChannel >= 0) {
+                CalcNodeTransform(NodeTransformation, AnimationTime, m_Clips[nAnim], nChannel, NULL);
+            } else {
+                BakedPoses::load(node.localTransform, NodeTransformation);
+            }
 
-        if (m_BoneMapping.find(NodeName) != m_BoneMapping.end()) {
-            const uint32_t BoneIndex = m_BoneMapping[NodeName];
-            m_BoneInfo[BoneIndex].FinalTransformation = m_GlobalInverseTransform * GlobalTransformation * m_BoneInfo[BoneIndex].BoneOffset;
-        }
+            if (node.parent >= 0){
+                globals[i] = globals[node.parent] * NodeTransformation;
+            } else {
+                globals[i] = NodeTransformation;
+            }
 
-        for (uint32_t i = 0 ; i < pNode->mNumChildren ; i++) {
-            ReadNodeHeirarchy(AnimationTime, pNode->mChildren[i], GlobalTransformation);
+            if (node.bone >= 0) {
+                pose[node.bone] = m_GlobalInverseTransform * globals[i] * m_BoneInfo[node.bone].BoneOffset;
+            }
         }
     }
 
@@ -991,7 +2072,7 @@ bool isDir(string ruta){
 }
 
 /**
-* Comprueba si existe el directorio o fichero pasado por parmetro
+* Comprueba si existe el directorio o fichero pasado por par�metro
 */
 bool existe(string ruta){
     if(isDir(ruta)){
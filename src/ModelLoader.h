@@ -0,0 +1,152 @@
+#ifndef MODELLOADER_H_INCLUDED
+#define MODELLOADER_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#include "Model.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+/**
+* Loads several models at the same time. The CPU stage of each model (Model::loadData)
+* runs in the pool and the GL stage (Model::finalize) runs in the thread that calls
+* finish, which must own the GL context. The models are finalized as they are read, so
+* the uploads of the first ones overlap with the reading of the rest
+*/
+class ModelLoader {
+    public:
+        ModelLoader(ThreadPool &pool = ThreadPool::getDefault()) : pool(pool){
+            start = chrono::steady_clock::now();
+        }
+
+        /**
+        * Waits for the models still being read. The ones not finalized are deleted
+        */
+        ~ModelLoader(){
+            unique_lock<mutex> lock(loadMutex);
+            while (numRead() < models.size()){
+                loadCond.wait(lock);
+            }
+            for (size_t i = 0; i < models.size(); i++){
+                if (!models[i].finalized) delete models[i].model;
+            }
+        }
+
+        /**
+        * Starts reading a model in the pool. The model can't be used until finish returns.
+        * The arguments are the same as the constructor of Model
+        */
+        Model *add(const string &path, Shader *shader, float fpsModelFactor = 1,
+                   int precalculateBonesTransform = BAKE_NONE, int bakeThreads = 0){
+            PendingModel pending;
+            pending.model = new Model();
+            pending.shader = shader;
+            pending.read = false;
+            pending.finalized = false;
+
+            size_t index;
+            {
+                unique_lock<mutex> lock(loadMutex);
+                index = models.size();
+                models.push_back(pending);
+            }
+            pool.run(bind(&ModelLoader::readModel, this, index, path, fpsModelFactor,
+                          precalculateBonesTransform, bakeThreads));
+            return pending.model;
+        }
+
+        /**
+        * Finalizes every model as soon as it has been read. It must be called from the thread
+        * of the GL context. Returns the milliseconds since the loader was created
+        */
+        double finish(){
+            size_t numFinalized = 0, numModels = 0;
+            {
+                unique_lock<mutex> lock(loadMutex);
+                numModels = models.size();
+                for (size_t i = 0; i < numModels; i++){
+                    if (models[i].finalized) numFinalized++;
+                }
+            }
+
+            while (numFinalized < numModels){
+                Model *model = NULL;
+                Shader *shader = NULL;
+                {
+                    unique_lock<mutex> lock(loadMutex);
+                    for (;;){
+                        for (size_t i = 0; model == NULL && i < models.size(); i++){
+                            if (models[i].read && !models[i].finalized){
+                                models[i].finalized = true;
+                                model = models[i].model;
+                                shader = models[i].shader;
+                            }
+                        }
+                        if (model != NULL) break;
+                        loadCond.wait(lock);
+                    }
+                }
+                model->finalize(shader);
+                numFinalized++;
+            }
+            return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        }
+
+    private:
+        //Not copyable, readModel runs in the pool with this pointer
+        ModelLoader(const ModelLoader &);
+        ModelLoader &operator=(const ModelLoader &);
+
+        struct PendingModel {
+            Model *model;
+            Shader *shader;
+            //loadData has finished
+            bool read;
+            //finalize has been called
+            bool finalized;
+        };
+
+        /**
+        * CPU stage of a model, in a worker of the pool
+        */
+        void readModel(size_t index, const string &path, float fpsModelFactor, int precalculateBonesTransform, int bakeThreads){
+            Model *model;
+            {
+                unique_lock<mutex> lock(loadMutex);
+                model = models[index].model;
+            }
+            model->loadData(path, fpsModelFactor, precalculateBonesTransform, bakeThreads);
+            {
+                unique_lock<mutex> lock(loadMutex);
+                models[index].read = true;
+                //Under loadMutex: the destructor returns, deleting loadCond, as soon as it sees read
+                loadCond.notify_all();
+            }
+        }
+
+        /**
+        * Models already read. loadMutex must be locked
+        */
+        size_t numRead(){
+            size_t n = 0;
+            for (size_t i = 0; i < models.size(); i++){
+                if (models[i].read) n++;
+            }
+            return n;
+        }
+
+        ThreadPool &pool;
+        chrono::steady_clock::time_point start;
+        //Guards models, which grows while the tasks are running
+        mutex loadMutex;
+        condition_variable loadCond;
+        vector<PendingModel> models;
+};
+
+#endif // MODELLOADER_H_INCLUDED
@@ -0,0 +1,76 @@
+#ifndef SKINNEDCACHE_H_INCLUDED
+#define SKINNEDCACHE_H_INCLUDED
+
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+using namespace std;
+
+//Floats written by the transform feedback for each vertex: position and normal
+#define SKINNED_VERTEX_FLOATS 6
+//Outputs of the skinning feedback shader, in the order of the buffer
+static const GLchar *SKINNED_FEEDBACK_VARYINGS[] = {"skinnedPosition", "skinnedNormal"};
+
+/**
+* Skinned vertices of one instance of a model, written by the transform feedback pass.
+* The meshes are stored one after the other in the same buffer, and each one has its own
+* VAO that reads the position and normal from here and the rest from the mesh
+*/
+class SkinnedCache {
+    public:
+        SkinnedCache(){
+            buffer = 0;
+            sizeInBytes = 0;
+            valid = false;
+        }
+
+        ~SkinnedCache(){
+            clear();
+        }
+
+        /**
+        * Transform feedback needs GL 3.0
+        */
+        static bool isSupported(){
+            return GLEW_VERSION_3_0 || GLEW_EXT_transform_feedback;
+        }
+
+        /**
+        *
+        */
+        void clear(){
+            if (!vaos.empty()){
+                glDeleteVertexArrays(vaos.size(), &vaos[0]);
+            }
+            if (buffer != 0){
+                glDeleteBuffers(1, &buffer);
+            }
+            vaos.clear();
+            offsets.clear();
+            buffer = 0;
+            sizeInBytes = 0;
+            valid = false;
+        }
+
+        bool isCreated(){return buffer != 0;}
+        size_t getSizeInBytes(){return sizeInBytes;}
+
+        //Buffer with SKINNED_VERTEX_FLOATS per vertex of all the meshes
+        GLuint buffer;
+        //Size of the buffer
+        size_t sizeInBytes;
+        //VAO and offset in the buffer of each mesh
+        vector<GLuint> vaos;
+        vector<GLintptr> offsets;
+        //The buffer has the pose of the last skinning pass
+        bool valid;
+
+    private:
+        //Not copyable, the GL objects are owned by this object
+        SkinnedCache(const SkinnedCache &);
+        SkinnedCache &operator=(const SkinnedCache &);
+};
+
+#endif // SKINNEDCACHE_H_INCLUDED
@@ -0,0 +1,243 @@
+#ifndef TEXTURECACHE_H_INCLUDED
+#define TEXTURECACHE_H_INCLUDED
+
+#include <map>
+#include <string>
+#include <iostream>
+#include <functional>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <ctype.h>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <SOIL.h>
+
+#include "MappedFile.h"
+#include "TextureStreamer.h"
+
+using namespace std;
+
+//Flags of the textures in the cache. The same file loaded with other flags is another texture
+//Four channels instead of three
+#define TEXTURE_CACHE_ALPHA 1
+//GL_CLAMP_TO_EDGE instead of GL_REPEAT
+#define TEXTURE_CACHE_CLAMP 2
+//Loaded like the textures of the models, by TextureFromFile or the TextureStreamer
+#define TEXTURE_CACHE_MODEL 4
+
+/**
+* Textures shared by the whole application. Each file is loaded once for each combination
+* of flags, and the texture is deleted when the last reference is released. The entries
+* are found by the hash of the canonical path of the file and the flags. It must be used
+* from the thread of the GL context
+*/
+class TextureCache {
+    public:
+        TextureCache(){
+            hits = 0;
+            misses = 0;
+        }
+
+        /**
+        * Shared cache for the whole application. The textures left must be deleted with
+        * clear while the GL context exists
+        */
+        static TextureCache &getDefault(){
+            static TextureCache cache;
+            return cache;
+        }
+
+        /**
+        * Returns the texture of the file with the flags, adding a reference. If it isn't in
+        * the cache it's loaded by load, or by loadImage if load is empty. Returns 0 if it
+        * can't be loaded
+        */
+        GLuint acquire(const string &path, uint32_t flags, const function<GLuint()> &load = function<GLuint()>()){
+            const string canonical = getCanonicalPath(path);
+            const uint64_t key = MappedFile::hash(&flags, sizeof(flags), MappedFile::hash(canonical.data(), canonical.size()));
+
+            map<uint64_t, CacheEntry>::iterator it = entries.find(key);
+            if (it != entries.end() && it->second.path == canonical && it->second.flags == flags){
+                it->second.refs++;
+                hits++;
+                return it->second.id;
+            }
+
+            misses++;
+            const GLuint id = load ? load() : loadImage(path, flags);
+            if (id == 0) return 0;
+            if (it != entries.end()){
+                //Two files with the same hash. The second one isn't shared
+                cout << "TextureCache: " << canonical << " has the same hash as " << it->second.path << endl;
+                unshared[id]++;
+                return id;
+            }
+
+            CacheEntry entry;
+            entry.id = id;
+            entry.refs = 1;
+            entry.flags = flags;
+            entry.path = canonical;
+            entries[key] = entry;
+            keys[id] = key;
+            return id;
+        }
+
+        /**
+        * Removes a reference of the texture, deleting it if it was the last one
+        */
+        void release(GLuint id){
+            map<GLuint, int>::iterator itUnshared = unshared.find(id);
+            if (itUnshared != unshared.end()){
+                if (--itUnshared->second == 0){
+                    unshared.erase(itUnshared);
+                    deleteTexture(id);
+                }
+                return;
+            }
+
+            map<GLuint, uint64_t>::iterator itKey = keys.find(id);
+            if (itKey == keys.end()) return;
+            map<uint64_t, CacheEntry>::iterator it = entries.find(itKey->second);
+            if (--it->second.refs == 0){
+                entries.erase(it);
+                keys.erase(itKey);
+                deleteTexture(id);
+            }
+        }
+
+        /**
+        * Deletes all the textures, even if they are still referenced
+        */
+        void clear(){
+            for (map<uint64_t, CacheEntry>::iterator it = entries.begin(); it != entries.end(); it++){
+                deleteTexture(it->second.id);
+            }
+            for (map<GLuint, int>::iterator it = unshared.begin(); it != unshared.end(); it++){
+                deleteTexture(it->first);
+            }
+            entries.clear();
+            keys.clear();
+            unshared.clear();
+        }
+
+        /**
+        * Prints the textures in the GPU and the memory saved by sharing them, compared with
+        * uploading one copy for each reference
+        */
+        void printStats(){
+            size_t bytes = 0, saved = 0;
+            int refs = 0;
+            for (map<uint64_t, CacheEntry>::iterator it = entries.begin(); it != entries.end(); it++){
+                const size_t textureBytes = getTextureBytes(it->second.id);
+                bytes += textureBytes;
+                saved += textureBytes * (it->second.refs - 1);
+                refs += it->second.refs;
+            }
+            cout << "TextureCache: " << entries.size() << " textures for " << refs << " references, " << bytes / 1024
+                 << " KB in the GPU, " << saved / 1024 << " KB saved. " << hits << " hits, " << misses << " misses" << endl;
+        }
+
+        /**
+        * Loads the image of the file without compression, with mipmaps
+        */
+        static GLuint loadImage(const string &path, uint32_t flags){
+            const bool alpha = (flags & TEXTURE_CACHE_ALPHA) != 0;
+            int width, height;
+            unsigned char* image = SOIL_load_image(path.c_str(), &width, &height, 0, alpha ? SOIL_LOAD_RGBA : SOIL_LOAD_RGB);
+            if (image == NULL){
+                cout << "TextureCache: " << path << " can't be read" << endl;
+                return 0;
+            }
+
+            GLuint textureID;
+            glGenTextures(1, &textureID);
+            glBindTexture(GL_TEXTURE_2D, textureID);
+            glTexImage2D(GL_TEXTURE_2D, 0, alpha ? GL_RGBA : GL_RGB, width, height, 0, alpha ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, image);
+            glGenerateMipmap(GL_TEXTURE_2D);
+
+            // Use GL_CLAMP_TO_EDGE to prevent semi-transparent borders. Due to interpolation it takes value from next repeat
+            const GLint wrap = (flags & TEXTURE_CACHE_CLAMP) != 0 ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            SOIL_free_image_data(image);
+            return textureID;
+        }
+
+        /**
+        * Absolute path of the file without links, "." or "..". If the file doesn't exist
+        * it's the path with forward slashes
+        */
+        static string getCanonicalPath(const string &path){
+#ifdef _WIN32
+            char buffer[_MAX_PATH];
+            string canonical = _fullpath(buffer, path.c_str(), _MAX_PATH) != NULL ? string(buffer) : path;
+            for (size_t i = 0; i < canonical.size(); i++){
+                if (canonical[i] == '\\') canonical[i] = '/';
+                else canonical[i] = tolower(canonical[i]);
+            }
+            return canonical;
+#else
+            char buffer[PATH_MAX];
+            if (realpath(path.c_str(), buffer) != NULL) return string(buffer);
+            string canonical = path;
+            for (size_t i = 0; i < canonical.size(); i++){
+                if (canonical[i] == '\\') canonical[i] = '/';
+            }
+            return canonical;
+#endif // _WIN32
+        }
+
+    private:
+        //Not copyable, the textures are owned by this object
+        TextureCache(const TextureCache &);
+        TextureCache &operator=(const TextureCache &);
+
+        struct CacheEntry {
+            GLuint id;
+            int refs;
+            uint32_t flags;
+            string path;
+        };
+
+        /**
+        * Bytes of the texture in the GPU, with its mipmaps
+        */
+        static size_t getTextureBytes(GLuint id){
+            GLint width = 0, height = 0, compressed = 0, size = 0, format = 0;
+            glBindTexture(GL_TEXTURE_2D, id);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+            if (compressed){
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            } else {
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+                size = width * height * (format == GL_RGB || format == GL_RGB8 ? 3 : 4);
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+            //The mipmaps add a third
+            return (size_t)size * 4 / 3;
+        }
+
+        static void deleteTexture(GLuint id){
+            TextureStreamer::getDefault().cancel(id);
+            glDeleteTextures(1, &id);
+        }
+
+        //Textures by the hash of their path and flags
+        map<uint64_t, CacheEntry> entries;
+        //Hash of each texture
+        map<GLuint, uint64_t> keys;
+        //References of the textures not shared because of a collision of the hashes
+        map<GLuint, int> unshared;
+        int hits;
+        int misses;
+};
+
+#endif // TEXTURECACHE_H_INCLUDED
@@ -0,0 +1,321 @@
+#ifndef TEXTURESTREAMER_H_INCLUDED
+#define TEXTURESTREAMER_H_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <string.h>
+#include <sys/stat.h>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <SOIL.h>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+//Bytes copied to the pixel buffers in each call to update
+#define TEXTURE_STREAM_BUDGET (512 * 1024)
+
+/**
+* Loads the textures without stopping the frame. request returns at once a texture with a
+* 1x1 placeholder, and the file is decoded in the pool. Each frame, update copies a budget
+* of the decoded pixels to a pixel buffer object, and when a texture is complete its image
+* is specified from the buffer in the same texture id, so the meshes using it don't change
+*/
+class TextureStreamer {
+    public:
+        TextureStreamer(ThreadPool &pool = ThreadPool::getDefault()) : pool(pool){
+            enabled = false;
+            pendingDecodes = 0;
+            nextSerial = 1;
+            numStreamed = 0;
+            bytesStreamed = 0;
+        }
+
+        /**
+        * Waits for the decodes in the pool. The GL objects must be released before with
+        * clear, while the context exists
+        */
+        ~TextureStreamer(){
+            unique_lock<mutex> lock(streamMutex);
+            while (pendingDecodes > 0){
+                decodeCond.wait(lock);
+            }
+            for (size_t i = 0; i < decoded.size(); i++){
+                SOIL_free_image_data(decoded[i].pixels);
+            }
+        }
+
+        /**
+        * Shared streamer for the whole application
+        */
+        static TextureStreamer &getDefault(){
+            static TextureStreamer streamer;
+            return streamer;
+        }
+
+        /**
+        * Pixel buffer objects need GL 2.1, and mapping a range of them without waiting for
+        * the GPU needs GL 3.0
+        */
+        static bool isSupported(){
+            return (GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object) && (GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range);
+        }
+
+        /**
+        * SOIL_load_image doesn't read DDS files, they are loaded directly by SOIL in GL
+        */
+        static bool canStream(const string &path){
+            const size_t dot = path.find_last_of('.');
+            string extension = dot != string::npos ? path.substr(dot + 1) : "";
+            transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            return extension != "dds";
+        }
+
+        void setEnabled(bool enabled){this->enabled = enabled && isSupported();}
+        bool isEnabled(){return enabled;}
+
+        /**
+        * Returns a texture with a 1x1 placeholder and queues the decode of the file. The
+        * file is looked for in the directory, and by its name only if it's not there.
+        * normalMap uses a flat normal as placeholder instead of white
+        */
+        GLuint request(const string &path, const string &directory, bool alpha, bool normalMap = false){
+            const GLubyte white[4] = {255, 255, 255, 255};
+            const GLubyte flatNormal[4] = {128, 128, 255, 255};
+            GLuint id;
+            glGenTextures(1, &id);
+            glBindTexture(GL_TEXTURE_2D, id);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, normalMap ? flatNormal : white);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            //GL reuses the ids of the deleted textures, the serial tells the requests apart
+            unsigned int serial;
+            {
+                unique_lock<mutex> lock(streamMutex);
+                if (requested.empty() && decoded.empty()){
+                    start = chrono::steady_clock::now();
+                }
+                serial = nextSerial++;
+                requested[id] = serial;
+                pendingDecodes++;
+            }
+            pool.run(bind(&TextureStreamer::decode, this, id, serial, path, directory, alpha));
+            return id;
+        }
+
+        /**
+        * The texture is being deleted. Its decoded pixels won't be uploaded
+        */
+        void cancel(GLuint id){
+            unique_lock<mutex> lock(streamMutex);
+            requested.erase(id);
+        }
+
+        /**
+        * Copies up to budget bytes of the decoded textures to their pixel buffers, and
+        * specifies the images of the textures that are complete. It must be called from the
+        * thread of the GL context, once per frame
+        */
+        void update(size_t budget = TEXTURE_STREAM_BUDGET){
+            while (budget > 0){
+                DecodedTexture texture;
+                {
+                    unique_lock<mutex> lock(streamMutex);
+                    //The textures deleted while they were decoded are dropped
+                    while (!decoded.empty() && !isRequested(decoded.front())){
+                        discard(decoded.front());
+                        decoded.pop_front();
+                    }
+                    if (decoded.empty()) return;
+                    texture = decoded.front();
+                }
+
+                const size_t size = texture.getSizeInBytes();
+                if (texture.buffer == 0){
+                    glGenBuffers(1, &texture.buffer);
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture.buffer);
+                    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+                } else {
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture.buffer);
+                }
+
+                //The GPU doesn't read the buffer until the texture is specified
+                const size_t bytes = min(budget, size - texture.bytesCopied);
+                void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, texture.bytesCopied, bytes,
+                                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+                if (dst != NULL){
+                    memcpy(dst, texture.pixels + texture.bytesCopied, bytes);
+                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                }
+                texture.bytesCopied += bytes;
+                budget -= bytes;
+
+                const bool complete = texture.bytesCopied == size || dst == NULL;
+                if (complete){
+                    if (dst != NULL){
+                        specify(texture);
+                        numStreamed++;
+                        bytesStreamed += size;
+                    } else {
+                        cout << "TextureStreamer: the pixel buffer of " << texture.path << " can't be mapped, it keeps the placeholder" << endl;
+                    }
+                    glDeleteBuffers(1, &texture.buffer);
+                    texture.buffer = 0;
+                }
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+                unique_lock<mutex> lock(streamMutex);
+                if (complete){
+                    if (isRequested(texture)) requested.erase(texture.id);
+                    SOIL_free_image_data(texture.pixels);
+                    decoded.pop_front();
+                    if (requested.empty()){
+                        cout << "TextureStreamer: " << numStreamed << " textures, " << bytesStreamed / 1024 << " KB streamed in "
+                             << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+                    }
+                } else {
+                    decoded.front() = texture;
+                }
+            }
+        }
+
+        /**
+        * Textures requested that aren't resident yet
+        */
+        size_t getNumPending(){
+            unique_lock<mutex> lock(streamMutex);
+            return requested.size();
+        }
+
+        /**
+        * Releases the pixel buffers and the decoded pixels waiting to be uploaded
+        */
+        void clear(){
+            unique_lock<mutex> lock(streamMutex);
+            for (size_t i = 0; i < decoded.size(); i++){
+                discard(decoded[i]);
+            }
+            decoded.clear();
+            requested.clear();
+        }
+
+    private:
+        //Not copyable, the decodes queued in the pool keep a pointer to it
+        TextureStreamer(const TextureStreamer &);
+        TextureStreamer &operator=(const TextureStreamer &);
+
+        struct DecodedTexture {
+            GLuint id;
+            //Serial of the request, the id may have been deleted and reused since then
+            unsigned int serial;
+            string path;
+            unsigned char *pixels;
+            int width;
+            int height;
+            int channels;
+            //Pixel buffer being filled, and how much of it
+            GLuint buffer;
+            size_t bytesCopied;
+
+            size_t getSizeInBytes() const {
+                return (size_t)width * height * channels;
+            }
+        };
+
+        /**
+        * Reads the file in a worker of the pool
+        */
+        void decode(GLuint id, unsigned int serial, const string &path, const string &directory, bool alpha){
+            string filename = directory + '/' + path;
+            struct stat info;
+            if (stat(filename.c_str(), &info) != 0){
+                const size_t slash = path.find_last_of("/\\");
+                filename = directory + '/' + (slash != string::npos ? path.substr(slash + 1) : path);
+            }
+
+            DecodedTexture texture;
+            texture.id = id;
+            texture.serial = serial;
+            texture.path = filename;
+            texture.channels = alpha ? 4 : 3;
+            texture.buffer = 0;
+            texture.bytesCopied = 0;
+            texture.pixels = SOIL_load_image(filename.c_str(), &texture.width, &texture.height, 0,
+                                             alpha ? SOIL_LOAD_RGBA : SOIL_LOAD_RGB);
+
+            unique_lock<mutex> lock(streamMutex);
+            if (texture.pixels == NULL){
+                cout << "TextureStreamer: " << filename << " can't be read, it keeps the placeholder" << endl;
+                if (isRequested(texture)) requested.erase(id);
+            } else {
+                decoded.push_back(texture);
+            }
+            pendingDecodes--;
+            //Still locked, so the destructor can't destroy decodeCond before this returns
+            decodeCond.notify_all();
+        }
+
+        /**
+        * Specifies the image of the texture from its pixel buffer, which must be bound
+        */
+        void specify(const DecodedTexture &texture){
+            const GLenum format = texture.channels == 4 ? GL_RGBA : GL_RGB;
+            glBindTexture(GL_TEXTURE_2D, texture.id);
+            //The rows of RGB images aren't aligned to 4 bytes
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, texture.width, texture.height, 0, format, GL_UNSIGNED_BYTE, (GLvoid*)0);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        /**
+        * The decoded texture belongs to the current request of its id. It may have been
+        * deleted, and the id given to another texture. streamMutex must be locked
+        */
+        bool isRequested(const DecodedTexture &texture){
+            map<GLuint, unsigned int>::iterator it = requested.find(texture.id);
+            return it != requested.end() && it->second == texture.serial;
+        }
+
+        /**
+        * Frees a texture that won't be uploaded. streamMutex must be locked
+        */
+        void discard(DecodedTexture &texture){
+            if (texture.buffer != 0) glDeleteBuffers(1, &texture.buffer);
+            SOIL_free_image_data(texture.pixels);
+            texture.buffer = 0;
+            texture.pixels = NULL;
+        }
+
+        ThreadPool &pool;
+        bool enabled;
+        //Guards everything below
+        mutex streamMutex;
+        condition_variable decodeCond;
+        int pendingDecodes;
+        unsigned int nextSerial;
+        //Textures requested and not resident yet, with the serial of their request
+        map<GLuint, unsigned int> requested;
+        //Decoded textures waiting to be uploaded, the first one is being copied
+        deque<DecodedTexture> decoded;
+        chrono::steady_clock::time_point start;
+        int numStreamed;
+        size_t bytesStreamed;
+};
+
+#endif // TEXTURESTREAMER_H_INCLUDED
@@ -0,0 +1,165 @@
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+using namespace std;
+
+/**
+* Fixed group of worker threads consuming a queue of tasks
+*/
+class ThreadPool {
+    public:
+        /**
+        * numWorkers = 0 creates one worker less than the hardware threads, because
+        * the thread calling parallelFor also does its part of the work
+        */
+        ThreadPool(int numWorkers = 0){
+            stopping = false;
+            if (numWorkers <= 0){
+                numWorkers = getHardwareThreads() - 1;
+            }
+            for (int i=0; i < numWorkers; i++){
+                workers.push_back(thread(&ThreadPool::workerLoop, this));
+            }
+        }
+
+        ~ThreadPool(){
+            {
+                unique_lock<mutex> lock(queueMutex);
+                stopping = true;
+            }
+            queueCond.notify_all();
+            for (size_t i=0; i < workers.size(); i++){
+                workers[i].join();
+            }
+        }
+
+        /**
+        * Shared pool for the whole application
+        */
+        static ThreadPool &getDefault(){
+            static ThreadPool pool;
+            return pool;
+        }
+
+        static int getHardwareThreads(){
+            int n = thread::hardware_concurrency();
+            return n > 0 ? n : 1;
+        }
+
+        int getNumWorkers(){
+            return workers.size();
+        }
+
+        /**
+        * Queues a task to be run by any of the workers
+        */
+        void addTask(const function<void()> &task){
+            {
+                unique_lock<mutex> lock(queueMutex);
+                tasks.push(task);
+            }
+            queueCond.notify_one();
+        }
+
+        /**
+        * Queues the task, or runs it before returning if the pool has no workers. A pool
+        * created in a machine with one hardware thread has none
+        */
+        void run(const function<void()> &task){
+            if (workers.empty()){
+                task();
+            } else {
+                addTask(task);
+            }
+        }
+
+        /**
+        * Calls func(begin, end) over chunks of [0, count) in the workers and in the calling
+        * thread. Returns when all the chunks are processed. Every call to func can use its
+        * own scratch memory for the whole chunk
+        */
+        void parallelFor(int count, int chunk, const function<void(int, int)> &func){
+            if (count <= 0) return;
+            if (chunk < 1) chunk = 1;
+
+            shared_ptr<ForState> state(new ForState());
+            state->next = 0;
+            state->done = 0;
+            state->count = count;
+            state->chunk = chunk;
+            state->func = func;
+
+            const int nChunks = (count + chunk - 1) / chunk;
+            const int nTasks = min((int)workers.size(), nChunks - 1);
+            for (int i=0; i < nTasks; i++){
+                addTask(bind(&ThreadPool::runChunks, state));
+            }
+            runChunks(state);
+
+            unique_lock<mutex> lock(state->doneMutex);
+            while (state->done < count){
+                state->doneCond.wait(lock);
+            }
+        }
+
+    private:
+        struct ForState {
+            atomic<int> next;
+            atomic<int> done;
+            int count;
+            int chunk;
+            function<void(int, int)> func;
+            mutex doneMutex;
+            condition_variable doneCond;
+        };
+
+        static void runChunks(shared_ptr<ForState> state){
+            while (true){
+                const int begin = state->next.fetch_add(state->chunk);
+                if (begin >= state->count) break;
+                const int end = min(begin + state->chunk, state->count);
+                state->func(begin, end);
+                if (state->done.fetch_add(end - begin) + (end - begin) == state->count){
+                    unique_lock<mutex> lock(state->doneMutex);
+                    state->doneCond.notify_all();
+                }
+            }
+        }
+
+        void workerLoop(){
+            while (true){
+                function<void()> task;
+                {
+                    unique_lock<mutex> lock(queueMutex);
+                    while (!stopping && tasks.empty()){
+                        queueCond.wait(lock);
+                    }
+                    if (stopping && tasks.empty()) return;
+                    task = tasks.front();
+                    tasks.pop();
+                }
+                task();
+            }
+        }
+
+        //Not copyable
+        ThreadPool(const ThreadPool &);
+        ThreadPool &operator=(const ThreadPool &);
+
+        vector<thread> workers;
+        queue<function<void()> > tasks;
+        mutex queueMutex;
+        condition_variable queueCond;
+        bool stopping;
+};
+
+#endif // THREADPOOL_H_INCLUDED
@@ -12,6 +12,8 @@
 #include "Shader.h"
 #include "Camera.h"
 #include "Model.h"
+#include "AnimationCrowd.h"
+#include "ModelLoader.h"
 
 // GLM Mathemtics
 #include <glm/glm.hpp>
@@ -99,12 +101,35 @@ int main(int argc, char *argv[]){
     // Define the viewport dimensions
     glViewport(0, 0, screenWidth, screenHeight);
 
+    //Blending the bones with dual quaternions instead of matrices
+    bool dualQuatSkinning = false;
+    for (int i=1; i < argc; i++){
+        if (strcmp(argv[i], "-dqskinning") == 0){
+            dualQuatSkinning = true;
+        }
+    }
+    const char *modelVertexShader = dualQuatSkinning ? "shaders/animation/model_dq.vertexshader" : "shaders/animation/model.vertexshader";
+
     // Setup and compile our shaders
-    Shader shader("shaders/animation/model.vertexshader", "shaders/animation/model.fragmentshader");
-    Shader shaderStencil("shaders/animation/model.vertexshader", "shaders/stencil/shaderSingleColor.fragmentshader");
+    Shader shader(modelVertexShader, "shaders/animation/model.fragmentshader");
+    Shader shaderStencil(modelVertexShader, "shaders/stencil/shaderSingleColor.fragmentshader");
     Shader lampShader("shaders/multiplelights/lamp.vertexshader", "shaders/multiplelights/lamp.fragmentshader");
     Shader debugShader("shaders/animation/debug.vertexshader", "shaders/animation/debug.fragmentshader");
 
+    //Skinning the highlighted characters once per frame, for the normal and the stencil passes
+    Shader *skinningShader = NULL;
+    for (int i=1; i < argc; i++){
+        if (strcmp(argv[i], "-skincache") == 0){
+            if (dualQuatSkinning || !SkinnedCache::isSupported()){
+                cout << "The skinning cache needs linear skinning and transform feedback" << endl;
+            } else {
+                skinningShader = new Shader("shaders/animation/skinning_feedback.vertexshader",
+                                            "shaders/stencil/shaderSingleColor.fragmentshader",
+                                            SKINNED_FEEDBACK_VARYINGS, 2);
+            }
+        }
+    }
+
 
     ObjectUtils objUtil;
     GLuint VBO, lightVAO;
@@ -113,10 +138,74 @@ int main(int argc, char *argv[]){
     shader.Use();   // <-- Don't forget this one!
     // Load models
 
+    //Baking the animations on their first use instead of at load
+    int bakeMode = BAKE_ALL;
+    for (int i=1; i < argc; i++){
+        if (strcmp(argv[i], "-lazybake") == 0){
+            bakeMode = BAKE_LAZY_ASYNC;
+        }
+    }
+
+    //Loading the models one after another, to compare with the concurrent load
+    bool serialLoad = false;
+    //Decoding the textures in the pool and uploading them in the frames, or at load
+    bool streamTextures = true;
+    for (int i=1; i < argc; i++){
+        if (strcmp(argv[i], "-serialload") == 0){
+            serialLoad = true;
+        } else if (strcmp(argv[i], "-synctextures") == 0){
+            streamTextures = false;
+        }
+    }
+    TextureStreamer::getDefault().setEnabled(streamTextures);
+
     //Model *ourWorld = new Model("models/cs_assault/cs_assault.obj", &shader);
-    Model *ourModel = new Model("models/ArmyPilot/ArmyPilot.ms3d", &shader, 1, true);
-    Model *ourModel2 = new Model("models/Bikini_Girl/Bikini_Girl.dae", &shader, 1, true);
-    Model *ourWorld = new Model("models/OldHouse2/Old House 2 3D Models.obj", &shader);
+    Model *ourModel, *ourModel2, *ourWorld;
+    chrono::steady_clock::time_point loadStart = chrono::steady_clock::now();
+    if (serialLoad){
+        ourModel = new Model("models/ArmyPilot/ArmyPilot.ms3d", &shader, 1, bakeMode);
+        ourModel2 = new Model("models/Bikini_Girl/Bikini_Girl.dae", &shader, 1, bakeMode);
+        ourWorld = new Model("models/OldHouse2/Old House 2 3D Models.obj", &shader);
+    } else {
+        //The files are read in the pool and uploaded here, in the thread of the context
+        ModelLoader loader;
+        ourModel = loader.add("models/ArmyPilot/ArmyPilot.ms3d", &shader, 1, bakeMode);
+        ourModel2 = loader.add("models/Bikini_Girl/Bikini_Girl.dae", &shader, 1, bakeMode);
+        ourWorld = loader.add("models/OldHouse2/Old House 2 3D Models.obj", &shader);
+        loader.finish();
+    }
+    cout << "Models loaded " << (serialLoad ? "one after another" : "concurrently") << " in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - loadStart).count() << " ms" << endl;
+    if (dualQuatSkinning){
+        ourModel->setSkinningMode(SKINNING_DUAL_QUATERNION);
+        ourModel2->setSkinningMode(SKINNING_DUAL_QUATERNION);
+    }
+
+    //Shows the GL calls used to send the bones of each character
+    bool showGLCalls = false;
+    //Shows how many poses are shared between the instances of the models
+    bool showPoseStats = false;
+    //The memory saved by the texture cache is shown when all the textures are loaded
+    bool textureStatsShown = false;
+    //Measuring the scaling of the bake of the animations with the number of threads
+    for (int i=1; i < argc; i++){
+        if (strcmp(argv[i], "-benchbake") == 0){
+            ourModel->benchmarkBake(ThreadPool::getHardwareThreads());
+            ourModel2->benchmarkBake(ThreadPool::getHardwareThreads());
+        } else if (strcmp(argv[i], "-benchpose") == 0){
+            ourModel->benchmarkPose(1000);
+            ourModel2->benchmarkPose(1000);
+        } else if (strcmp(argv[i], "-validateskinning") == 0){
+            ourModel->validateCpuSkinning(10);
+            ourModel2->validateCpuSkinning(10);
+        } else if (strcmp(argv[i], "-benchkeys") == 0){
+            benchmarkKeyLookup(10000, 100000);
+        } else if (strcmp(argv[i], "-glcalls") == 0){
+            showGLCalls = true;
+        } else if (strcmp(argv[i], "-posestats") == 0){
+            showPoseStats = true;
+        }
+    }
 
     // Draw in wireframe
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -131,7 +220,7 @@ int main(int argc, char *argv[]){
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     //Stencil opts
-    sceneObjects.activateStencil(false);
+    sceneObjects.activateStencil(skinningShader != NULL);
 
     //To generate a plane ground
 //    Model *ourWorld = new Model();
@@ -154,11 +243,14 @@ int main(int argc, char *argv[]){
     obj->rotation = glm::angleAxis(glm::radians(0.0f), glm::vec3(0.f, 1.f, 0.f)); //Rotacion de 90 grados en el eje y
     obj->meshModel = ourWorld;
     obj->tag = "ground";
-    sceneObjects.initShape(obj);
+    //The objects without shape aren't in the scene, nobody else owns them
+    if (sceneObjects.initShape(obj) < 0) delete obj;
 
 
+    object3D *pilot = NULL;
     for (int i=0; i < 1; i++){
         object3D *obj = new object3D();
+        pilot = obj;
         obj->aproxHullShape = APROXCYCLINDER;
         obj->spinningFriction = 10.0f;
         obj->dimension = btVector3(0.0, 1.8, 0.0);
@@ -167,7 +259,10 @@ int main(int argc, char *argv[]){
         obj->meshModel = ourModel;
         obj->tag = "model_pilot";
         obj->stencil = true;
-        sceneObjects.initShape(obj);
+        if (sceneObjects.initShape(obj) < 0){
+            delete obj;
+            pilot = NULL;
+        }
     }
 
     //Another model
@@ -180,10 +275,51 @@ int main(int argc, char *argv[]){
     obj2->meshModel = ourModel2;
     obj2->tag = "model_bikini";
     obj2->stencil = false;
-    sceneObjects.initShape(obj2);
+    if (sceneObjects.initShape(obj2) < 0) delete obj2;
+
+    //The physic shapes have their own copy of the triangles. The characters keep their
+    //positions to build the shapes of new instances, the house doesn't need anything
+    ourWorld->setResidency(RESIDENCY_RELEASE_ALL);
+    ourModel->setResidency(RESIDENCY_PHYSICS);
+    ourModel2->setResidency(RESIDENCY_PHYSICS);
+
+    //Crowd of pilots drawn with instancing, reading the baked poses from the GPU
+    AnimationCrowd *crowd = NULL;
+    Shader *crowdShader = NULL;
+    vector<Light *> lucesCrowd;
+    for (int i=1; i < argc - 1; i++){
+        if (strcmp(argv[i], "-crowd") == 0){
+            crowd = new AnimationCrowd();
+            if (pilot != NULL && crowd->init(ourModel)){
+                crowdShader = new Shader("shaders/animation/model_crowd.vertexshader", "shaders/animation/model.fragmentshader");
+                initLights(lucesCrowd, *crowdShader);
+
+                //In rows behind the characters, with the scale and rotation of the pilot
+                const int numInstances = max(atoi(argv[i + 1]), 1);
+                const int side = ceil(sqrt((float)numInstances));
+                const glm::mat4 pose = glm::toMat4(pilot->rotation)
+                    * glm::scale(glm::mat4(), glm::vec3(pilot->scaling.x(), pilot->scaling.y(), pilot->scaling.z()));
+                vector<CrowdInstance> instances(numInstances);
+                for (int n = 0; n < numInstances; n++){
+                    const glm::mat4 world = glm::translate(glm::mat4(),
+                        glm::vec3((n % side) * 1.5f - side * 0.75f, 0.0f, -4.0f - (n / side) * 1.5f)) * pose;
+                    memcpy(instances[n].model, glm::value_ptr(world), sizeof(instances[n].model));
+                    instances[n].nAnim = n % ourModel->getNumAnimations();
+                    instances[n].timeOffset = n * 0.37f;
+                }
+                crowd->setInstances(instances);
+                cout << "Crowd of " << numInstances << " pilots in " << ourModel->getMeshes()->size() << " draw calls" << endl;
+            } else {
+                delete crowd;
+                crowd = NULL;
+            }
+        }
+    }
 
     double lastTime = 0;
     int nbFrames = 0;
+    //Bone upload calls of the animated characters drawn in the last second
+    int nbCharacters = 0, nbBoneCalls = 0, nbBoneCallsPerBone = 0, nbBoneBytes = 0;
 
     vector<Light *> luces;
     initLights(luces, shader);
@@ -199,18 +335,38 @@ int main(int argc, char *argv[]){
         GLfloat currentFrame = glfwGetTime() - initTime;
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        //The poses of the last frame aren't shared with this one
+        PoseCache::nextFrame();
 
         nbFrames++;
         if ( currentFrame - lastTime >= 1.0 ){ // If last prinf() was more than 1 sec ago
             // printf and reset timer
             printf("%d frames/s\n", nbFrames);
+            if (showGLCalls && nbCharacters > 0){
+                printf("GL calls per character: %d, sending bone by bone: %d. Bytes of bones per character: %d\n",
+                       nbBoneCalls / nbCharacters, nbBoneCallsPerBone / nbCharacters, nbBoneBytes / nbCharacters);
+            }
+            if (showPoseStats && PoseCache::getStats().lookups > 0){
+                const PoseCacheStats &stats = PoseCache::getStats();
+                printf("Pose cache hit rate: %.1f%%, bones evaluated per frame: %ld\n",
+                       100.0 * stats.hits.load() / stats.lookups.load(), stats.bonesEvaluated.load() / nbFrames);
+            }
+            PoseCache::resetStats();
             nbFrames = 0;
+            nbCharacters = nbBoneCalls = nbBoneCallsPerBone = nbBoneBytes = 0;
             lastTime += 1.0;
         }
 
         // Check and call events
         glfwPollEvents();
         Do_Movement();
+        //Uploads a part of the textures decoded in the background
+        TextureStreamer::getDefault().update();
+        if (!textureStatsShown && TextureStreamer::getDefault().getNumPending() == 0){
+            //The sizes of the textures are known once they are resident
+            TextureCache::getDefault().printStats();
+            textureStatsShown = true;
+        }
 
         // Clear the colorbuffer
         glClearColor(cielo.x, cielo.y, cielo.z, 1.0f);
@@ -244,6 +400,25 @@ int main(int argc, char *argv[]){
         /** para la escena del modelo*/
         //Calculate the physics
         sceneObjects.getPhysics()->getDynamicsWorld()->stepSimulation(deltaTime); //suppose you have 60 frames per second
+
+        //Update phase: the poses of all the animated objects are calculated in parallel,
+        //so the render phase only has to upload them
+        const GLfloat frameMillis = estadoPersonaje.x + fmod(currentFrame * 2.0f, estadoPersonaje.y);
+        vector<object3D *> animated;
+        //Distance to the camera of each one, to choose the level of detail of the animation
+        vector<float> distances;
+        for (int i = 0; i< sceneObjects.getPhysics()->getCollisionObjectCount(); i++) {
+            object3D *userPointer = sceneObjects.getObjPointer(i);
+            if (userPointer != NULL && userPointer->meshModel != NULL && userPointer->meshModel->hasAnimations()){
+                animated.push_back(userPointer);
+                distances.push_back(sceneObjects.getObjectDistance(i, camera.Position));
+            }
+        }
+        ThreadPool::getDefault().parallelFor(animated.size(), 1, [&](int begin, int end){
+            for (int i = begin; i < end; i++){
+                animated[i]->meshModel->updateInstance(animated[i]->animInstance, frameMillis, 0, distances[i]);
+            }
+        });
         for (int i = 0; i< sceneObjects.getPhysics()->getCollisionObjectCount(); i++) {
             object3D *userPointer = sceneObjects.getObjPointer(i);
             if (userPointer != NULL) {
@@ -256,22 +431,46 @@ int main(int argc, char *argv[]){
                                glm::vec3(userPointer->scaling.x(), userPointer->scaling.y(), userPointer->scaling.z()),
                                glm::vec3(0.0f, 0.0f, 0.0f), model))
                 {
+                    //The highlighted characters are drawn twice, so they are skinned only once
+                    const bool skinned = skinningShader != NULL && sceneObjects.stencil && userPointer->stencil
+                        && userPointer->meshModel->skinToCache(skinningShader, &userPointer->animInstance, userPointer->skinCache);
                     shader.Use();
                     //Informing data of model
                     glUniformMatrix4fv(personLoc, 1, GL_FALSE, glm::value_ptr(model));
                     //Calculamos la inversa de la matriz por temas de iluminacion y rendimiento
                     transInversMatrix = transpose(inverse(model));
                     glUniformMatrix4fv(transInversLoc, 1, GL_FALSE, glm::value_ptr(transInversMatrix));
-                    const GLfloat frameMillis = estadoPersonaje.x + fmod(currentFrame * 2.0f, estadoPersonaje.y);
                     //Drawing the model with textures
-                    userPointer->meshModel->Draw(&shader, frameMillis);
+                    if (skinned){
+                        userPointer->meshModel->DrawSkinned(&shader, userPointer->skinCache);
+                    } else {
+                        userPointer->meshModel->Draw(&shader, &userPointer->animInstance);
+                    }
+                    if (userPointer->meshModel->hasAnimations()){
+                        nbCharacters++;
+                        nbBoneCalls += userPointer->meshModel->getBoneUploadCalls();
+                        nbBoneCallsPerBone += userPointer->meshModel->getBoneUploadCallsPerBone();
+                        nbBoneBytes += userPointer->meshModel->getBoneUploadBytes();
+                    }
                     //Drawing the model for stencil
                     if (sceneObjects.mustProcessStencil(i,model,shaderStencil)){
-                        userPointer->meshModel->Draw(&shaderStencil, frameMillis);
+                        if (skinned){
+                            userPointer->meshModel->DrawSkinned(&shaderStencil, userPointer->skinCache);
+                        } else {
+                            userPointer->meshModel->Draw(&shaderStencil, &userPointer->animInstance);
+                        }
                     }
                 }
             }
 		}
+        if (crowd != NULL){
+            crowdShader->Use();
+            glUniform3f(glGetUniformLocation(crowdShader->Program, "viewPos"), camera.Position.x, camera.Position.y, camera.Position.z);
+            glUniformMatrix4fv(glGetUniformLocation(crowdShader->Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+            glUniformMatrix4fv(glGetUniformLocation(crowdShader->Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+            processLights(lucesCrowd, *crowdShader);
+            crowd->Draw(crowdShader, currentFrame);
+        }
         /**Fin modelo*/
 
 //        objUtil.drawPlane(sceneObjects, projection, view);
@@ -332,6 +531,16 @@ int main(int argc, char *argv[]){
     delete ourWorld;
     delete ourModel;
     delete ourModel2;
+    delete skinningShader;
+    delete crowd;
+    delete crowdShader;
+    //The objects outlive the context, their skinned buffers are released while it exists
+    for (int i = 0; i < sceneObjects.getPhysics()->getCollisionObjectCount(); i++){
+        object3D *userPointer = sceneObjects.getObjPointer(i);
+        if (userPointer != NULL) userPointer->skinCache.clear();
+    }
+    TextureStreamer::getDefault().clear();
+    TextureCache::getDefault().clear();
     glfwTerminate();
     return 0;
 }
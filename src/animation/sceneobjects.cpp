@@ -31,18 +31,26 @@ object3D::~object3D(){
 }
 
 /**
-*
+* Returns NULL if the shape can't be built: the model has released its meshes or it has
+* no triangles
 */
 btCollisionShape* object3D::createShapeWithVertices(Model *ourModel){
+    //The positions are needed, at least, with RESIDENCY_PHYSICS
+    for (int idMesh=0; idMesh < ourModel->getMeshes()->size(); idMesh++){
+        if (ourModel->getMeshes()->at(idMesh)->getResidency() == RESIDENCY_RELEASE_ALL){
+            cout << "createShapeWithVertices: the model " << this->tag << " has released its meshes" << endl;
+            return NULL;
+        }
+    }
     //1
     if (convex){
         btConvexHullShape* originalConvexShape = new btConvexHullShape();
         //2
         for (int idMesh=0; idMesh < ourModel->getMeshes()->size(); idMesh++){
-            vector<Vertex> *vertices = ourModel->getMeshes()->at(idMesh)->getVertices();
-            for (int i = 0; i < vertices->size(); i += 4){
-                const Vertex v = vertices->at(i);
-                originalConvexShape->addPoint(btVector3(v.Position[0], v.Position[1], v.Position[2]));
+            Mesh *mesh = ourModel->getMeshes()->at(idMesh);
+            for (int i = 0; i < mesh->getNumPositions(); i += 4){
+                const glm::vec3 &v = mesh->getPosition(i);
+                originalConvexShape->addPoint(btVector3(v[0], v[1], v[2]));
             }
         }
 
@@ -93,20 +101,14 @@ btCollisionShape* object3D::createShapeWithVertices(Model *ourModel){
 
         //Calculamos en primer lugar el numero de vertices de todos los meshes
         for (int idMesh=0; idMesh < ourModel->getMeshes()->size(); idMesh++){
-            vector<Vertex> *vertices = ourModel->getMeshes()->at(idMesh)->getVertices();
-            vector<GLuint> *indices  = ourModel->getMeshes()->at(idMesh)->getIndices();
-            int index_count = indices->size();
+            Mesh *mesh = ourModel->getMeshes()->at(idMesh);
+            int index_count = mesh->getIndices()->size();
             //Aseguramos que hay un numero correcto de vertices. En caso contrario (que no deberia pasar)
             //replicamos el ultimo vertice
-            int nVertices = vertices->size();
-
-            int verticesLeft =  nVertices % 3 == 0 ? 0 : 3 - nVertices % 3;
-            if (verticesLeft != 0 && nVertices > 0 && index_count == 0){
-                for (int i=0; i < verticesLeft; i++){
-                    vertices->push_back(vertices->at(nVertices - 1));
-                }
+            int nVertices = mesh->getNumPositions();
+            if (index_count == 0){
+                nVertices = (nVertices + 2) / 3 * 3;
             }
-            nVertices = vertices->size();
             nVertMeshes += nVertices;
             nIndxMeshes += index_count;
         }
@@ -121,17 +123,19 @@ btCollisionShape* object3D::createShapeWithVertices(Model *ourModel){
             ourModel->initTriMeshPhis(totalFaces);
 
             for (int idMesh=0; idMesh < ourModel->getMeshes()->size(); idMesh++){
-                vector<Vertex> *vertices = ourModel->getMeshes()->at(idMesh)->getVertices();
-                vector<GLuint> *indices  = ourModel->getMeshes()->at(idMesh)->getIndices();
+                Mesh *mesh = ourModel->getMeshes()->at(idMesh);
+                vector<GLuint> *indices  = mesh->getIndices();
                 int index_count = indices->size();
 
                 if (!indexed){
-                    unsigned int nFaces = vertices->size()/3;
+                    //The missing vertices of the last face are the last one
+                    const unsigned int nPositions = mesh->getNumPositions();
+                    unsigned int nFaces = (nPositions + 2) / 3;
                     for (int i=0; i < nFaces; i++){
                         addPhysMeshTriangle(ourModel,
                                             ourModel->triMeshPhis[cFace],
-                                            vertices->at(i*3), vertices->at(i*3+1),
-                                            vertices->at(i*3+2));
+                                            mesh->getPosition(i*3), mesh->getPosition(min((unsigned int)i*3+1, nPositions - 1)),
+                                            mesh->getPosition(min((unsigned int)i*3+2, nPositions - 1)));
 
                         cFace++;
                     }
@@ -140,8 +144,8 @@ btCollisionShape* object3D::createShapeWithVertices(Model *ourModel){
                     for (int i=0; i < nFaces; i++){
                         addPhysMeshTriangle(ourModel,
                                             ourModel->triMeshPhis[cFace],
-                                            vertices->at(indices->at(i*3)), vertices->at(indices->at(i*3+1)),
-                                            vertices->at(indices->at(i*3+2)));
+                                            mesh->getPosition(indices->at(i*3)), mesh->getPosition(indices->at(i*3+1)),
+                                            mesh->getPosition(indices->at(i*3+2)));
                         cFace++;
                     }
                 }
@@ -202,17 +206,17 @@ btVector3 object3D::scaleToMeters(btVector3 &scaleMeters, btVector3 &aabb){
 /**
 *
 */
-void object3D::addPhysMeshTriangle(Model *ourModel, btVector3* triMeshPhis, Vertex &vec1, Vertex &vec2, Vertex &vec3){
+void object3D::addPhysMeshTriangle(Model *ourModel, btVector3* triMeshPhis, const glm::vec3 &vec1, const glm::vec3 &vec2, const glm::vec3 &vec3){
     triMeshPhis = new btVector3[3];
-    triMeshPhis[0].setX(btScalar(vec1.Position.x));
-    triMeshPhis[0].setY(btScalar(vec1.Position.y));
-    triMeshPhis[0].setZ(btScalar(vec1.Position.z));
-    triMeshPhis[1].setX(btScalar(vec2.Position.x));
-    triMeshPhis[1].setY(btScalar(vec2.Position.y));
-    triMeshPhis[1].setZ(btScalar(vec2.Position.z));
-    triMeshPhis[2].setX(btScalar(vec3.Position.x));
-    triMeshPhis[2].setY(btScalar(vec3.Position.y));
-    triMeshPhis[2].setZ(btScalar(vec3.Position.z));
+    triMeshPhis[0].setX(btScalar(vec1.x));
+    triMeshPhis[0].setY(btScalar(vec1.y));
+    triMeshPhis[0].setZ(btScalar(vec1.z));
+    triMeshPhis[1].setX(btScalar(vec2.x));
+    triMeshPhis[1].setY(btScalar(vec2.y));
+    triMeshPhis[1].setZ(btScalar(vec2.z));
+    triMeshPhis[2].setX(btScalar(vec3.x));
+    triMeshPhis[2].setY(btScalar(vec3.y));
+    triMeshPhis[2].setZ(btScalar(vec3.z));
 
     ourModel->physMesh->addTriangle(triMeshPhis[0],
                                     triMeshPhis[1],
@@ -221,10 +225,15 @@ void object3D::addPhysMeshTriangle(Model *ourModel, btVector3* triMeshPhis, Vert
 }
 
 /**
-*
+* Adds the object to the physics world. Returns -1 if its shape can't be built, and the
+* object isn't added
 */
 int SceneObjects::initShape(object3D *obj){
     btCollisionShape *newRigidShape = obj->createShapeWithVertices(obj->meshModel);
+    if (newRigidShape == NULL){
+        cout << "initShape: " << obj->tag << " has no shape, it isn't added to the scene" << endl;
+        return -1;
+    }
     physicsEngine->getCollisionShapes()->push_back(newRigidShape);
 
     //set the initial position and transform. For this demo, we set the tranform to be none
@@ -259,6 +268,7 @@ int SceneObjects::initShape(object3D *obj){
     //Incluimos el cuerpo en la libreria de fisica
     physicsEngine->getDynamicsWorld()->addRigidBody(body);
     //physicsEngine->trackRigidBodyWithName(body, physicsCubeName);
+    return 0;
 }
 
 /**
@@ -288,6 +298,20 @@ bool SceneObjects::getObjectModel(int i, glm::vec3 scale, glm::vec3 offset,  glm
     return out;
 }
 
+/**
+* Distance from the object to a point, like the camera
+*/
+float SceneObjects::getObjectDistance(int i, glm::vec3 point){
+    btCollisionObject* obj = getPhysics()->getDynamicsWorld()->getCollisionObjectArray()[i];
+    btRigidBody* body = btRigidBody::upcast(obj);
+    if (body && body->getMotionState()){
+        btTransform trans;
+        body->getMotionState()->getWorldTransform(trans);
+        return glm::distance(point, glm::vec3(trans.getOrigin().getX(), trans.getOrigin().getY(), trans.getOrigin().getZ()));
+    }
+    return 0;
+}
+
 /**
 *
 */
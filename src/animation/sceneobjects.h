@@ -112,6 +112,10 @@ class object3D{
         glm::quat rotation;
         //Mesh of the object
         Model *meshModel;
+        //Pose of this object, calculated in the update phase of each frame
+        AnimationInstance animInstance;
+        //Vertices skinned with the pose, shared by all the passes of the frame
+        SkinnedCache skinCache;
         //Sense of the vector
         int impulseSense;
         //Axis of the reference object for impulse
@@ -124,7 +128,7 @@ class object3D{
         btVector3 scaleToMeters(btVector3 &scaleMeters, btVector3 &aabb);
 
     private:
-        void addPhysMeshTriangle(Model *ourModel, btVector3* triMeshPhis, Vertex &vec1, Vertex &vec2, Vertex &vec3);
+        void addPhysMeshTriangle(Model *ourModel, btVector3* triMeshPhis, const glm::vec3 &vec1, const glm::vec3 &vec2, const glm::vec3 &vec3);
         btCollisionShape* shape;
 
 
@@ -155,6 +159,7 @@ class SceneObjects
 
         int initShape(object3D *obj);
         bool getObjectModel(int i, glm::vec3 scale, glm::vec3 offset,  glm::mat4 &model);
+        float getObjectDistance(int i, glm::vec3 point);
 
         object3D *getObjPointer(int i);
 
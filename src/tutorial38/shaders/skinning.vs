@@ -14,19 +14,20 @@ const int MAX_BONES = 100;
 
 uniform mat4 gWVP;
 uniform mat4 gWorld;
-uniform mat4 gBones[MAX_BONES];
+// Each bone is the transposed 3x4 transform, its last row is always 0,0,0,1
+uniform mat3x4 gBones[MAX_BONES];
 
 void main()
 {       
-    mat4 BoneTransform = gBones[BoneIDs[0]] * Weights[0];
-    BoneTransform     += gBones[BoneIDs[1]] * Weights[1];
-    BoneTransform     += gBones[BoneIDs[2]] * Weights[2];
-    BoneTransform     += gBones[BoneIDs[3]] * Weights[3];
+    mat3x4 BoneTransform = gBones[BoneIDs[0]] * Weights[0];
+    BoneTransform       += gBones[BoneIDs[1]] * Weights[1];
+    BoneTransform       += gBones[BoneIDs[2]] * Weights[2];
+    BoneTransform       += gBones[BoneIDs[3]] * Weights[3];
 
-    vec4 PosL    = BoneTransform * vec4(Position, 1.0);
+    vec4 PosL    = vec4(vec4(Position, 1.0) * BoneTransform, 1.0);
     gl_Position  = gWVP * PosL;
     TexCoord0    = TexCoord;
-    vec4 NormalL = BoneTransform * vec4(Normal, 0.0);
+    vec4 NormalL = vec4(vec4(Normal, 0.0) * BoneTransform, 0.0);
     Normal0      = (gWorld * NormalL).xyz;
     WorldPos0    = (gWorld * PosL).xyz;                                
 }
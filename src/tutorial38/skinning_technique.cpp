@@ -154,12 +154,7 @@ bool SkinningTechnique::Init()
         }
     }
 
-    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(m_boneLocation) ; i++) {
-        char Name[128];
-        memset(Name, 0, sizeof(Name));
-        SNPRINTF(Name, sizeof(Name), "gBones[%d]", i);
-        m_boneLocation[i] = GetUniformLocation(Name);
-    }
+    m_bonesLocation = GetUniformLocation("gBones");
 
     return true;
 }
@@ -246,9 +241,13 @@ void SkinningTechnique::SetSpotLights(unsigned int NumLights, const SpotLight* p
 }
 
 
-void SkinningTechnique::SetBoneTransform(uint Index, const Matrix4f& Transform)
+void SkinningTechnique::SetBoneTransforms(uint NumBones, const Matrix4f* pTransforms)
 {
-    assert(Index < MAX_BONES);
-    //Transform.Print();
-    glUniformMatrix4fv(m_boneLocation[Index], 1, GL_TRUE, (const GLfloat*)Transform);       
+    assert(NumBones <= MAX_BONES);
+    // The last row is always 0,0,0,1 so the shader only receives the first three
+    for (uint i = 0 ; i < NumBones ; i++) {
+        memcpy(&m_bonesPalette[i * 12], &pTransforms[i].m[0][0], 12 * sizeof(float));
+    }
+    // Each row is a column of the mat3x4 in the shader
+    glUniformMatrix3x4fv(m_bonesLocation, NumBones, GL_FALSE, m_bonesPalette);
 }
\ No newline at end of file
@@ -97,7 +97,7 @@ public:
     void SetEyeWorldPos(const Vector3f& EyeWorldPos);
     void SetMatSpecularIntensity(float Intensity);
     void SetMatSpecularPower(float Power);
-    void SetBoneTransform(uint Index, const Matrix4f& Transform);
+    void SetBoneTransforms(uint NumBones, const Matrix4f* pTransforms);
 
 private:
     
@@ -143,7 +143,9 @@ private:
         } Atten;
     } m_spotLightsLocation[MAX_SPOT_LIGHTS];
     
-    GLuint m_boneLocation[MAX_BONES];
+    GLuint m_bonesLocation;
+    //First three rows of each bone transform, uploaded with only one call
+    float m_bonesPalette[MAX_BONES * 12];
 };
 
 
@@ -129,8 +129,8 @@ public:
 
         m_mesh.BoneTransform(RunningTime, Transforms);
         
-        for (uint i = 0 ; i < Transforms.size() ; i++) {
-            m_pEffect->SetBoneTransform(i, Transforms[i]);
+        if (Transforms.size() > 0) {
+            m_pEffect->SetBoneTransforms(Transforms.size(), &Transforms[0]);
         }
         
         m_pEffect->SetEyeWorldPos(m_pGameCamera->GetPos());